@@ -1,7 +1,15 @@
 #include "MPC.h"
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <coin/IpIpoptApplication.hpp>
 #include <cppad/cppad.hpp>
-#include <cppad/ipopt/solve.hpp>
+#include <cppad/ipopt/solve_callback.hpp>
 #include "Eigen-3.3/Eigen/Core"
+#include "perf_counters.h"
+#include "trace.h"
 
 using CppAD::AD;
 
@@ -9,14 +17,6 @@ using CppAD::AD;
 // We only execute the very first set of control inputs; brings vehicle to a new state and process is repeated
 // The model, cost and constraints comprise the solver: Ipopt
 
-// TODO: Set the timestep length and duration
-// Prediction horizon is the duration of future predictions (prediction_horizon = N * dt)
-// Prediction horizon should be as large as possible, but no more than a few seconds
-// Number of time steps in the horizon
-size_t N = 10; // 5 goes nowhere; 8 makes front tail of MPC trajectory tails off to right often
-// How much times elapses between actuations in seconds; smaller is better
-double dt = 0.1;
-
 // Lf value assumes the model presented in the classroom is used.
 // It was obtained by measuring the radius formed by running the vehicle in the
 // simulator around in a circle with a constant steering angle and velocity on flat terrain.
@@ -24,27 +24,69 @@ double dt = 0.1;
 // presented in the classroom matched the previous radius.
 //
 // This is the length from front to the center of gravity; that has a similar radius.
-const double Lf = 2.67;
-
-// Reference, or desired states for each
-double ref_cte = 0;
-double ref_epsi = 0;
-double ref_v = 130;
-
-size_t x_start = 0;
-size_t y_start = x_start + N;
-size_t psi_start = y_start + N;
-size_t v_start = psi_start + N;
-size_t cte_start = v_start + N;
-size_t epsi_start = cte_start + N;
-size_t delta_start = epsi_start + N;
-size_t a_start = delta_start + N - 1;
+// It is MPCParams::Lf, with the reference states and the weights of the
+// objective in MPCParams::weights; see mpc_config.h.
+
+// Thread registry handed to CppAD; see MPC::SetupThreads
+namespace {
+std::thread::id main_thread_id = std::this_thread::get_id();
+std::atomic<size_t> next_thread_number(1);
+size_t num_cppad_threads = 1;
+// Ipopt linear solver; MUMPS is not reentrant, so calls into it are
+// serialized with solver_mutex when more than one thread solves
+std::string linear_solver = "mumps";
+bool serialize_solves = false;
+std::mutex solver_mutex;
+
+bool InParallel() { return std::this_thread::get_id() != main_thread_id; }
+
+size_t ThreadNumber() {
+  static thread_local size_t number =
+      InParallel() ? next_thread_number.fetch_add(1) : 0;
+  return number;
+}
+
+// CppAD's allocator counts of each thread as of its last solve. In parallel
+// mode CppAD only answers a thread about itself, so each solver thread
+// publishes its own here and MPC::AllocatorStats reads them from any thread.
+struct AllocatorSlot {
+  std::atomic<size_t> inuse;
+  std::atomic<size_t> available;
+};
+std::unique_ptr<AllocatorSlot[]> allocator_slots(new AllocatorSlot[1]());
+
+void PublishAllocatorStats() {
+  const size_t thread = ThreadNumber();
+  if (thread >= num_cppad_threads) {
+    return;
+  }
+  AllocatorSlot& slot = allocator_slots[thread];
+  slot.inuse.store(CppAD::thread_alloc::inuse(thread),
+                   std::memory_order_relaxed);
+  slot.available.store(CppAD::thread_alloc::available(thread),
+                       std::memory_order_relaxed);
+}
+}  // namespace
 
 class FG_eval {
  public:
-  // Fitted polynomial coefficients
+  // Fitted polynomial coefficients, in powers of (x - center) / half
   Eigen::VectorXd coeffs;
-  FG_eval(Eigen::VectorXd coeffs) { this->coeffs = coeffs; }
+  double center;
+  double half;
+  // Horizon and variable layout of the owning MPC, and its Lf
+  const Horizon& h;
+  const double Lf;
+  // References and weights of this solve's cost
+  const MPCWeights& w;
+  FG_eval(const ScaledPoly& reference, const MPCConfig& config,
+          const MPCWeights& weights)
+      : coeffs(reference.coeffs),
+        center(reference.center),
+        half(reference.half),
+        h(config.horizon()),
+        Lf(config.params().Lf),
+        w(weights) {}
 
   typedef CPPAD_TESTVECTOR(AD<double>) ADvector;
   void operator()(ADvector& fg, const ADvector& vars) {
@@ -57,37 +99,29 @@ class FG_eval {
     // Any additions to the cost should be added to 'fg[0]'
     fg[0] = 0;
 
-    // Define weights for different terms of objective
-    const double cte_w = 1500;
-    const double epsi_w = 2000;
-    const double v_w = 1; // 100 can't make sharpest turn
-    const double actuator_w = 10;
-    const double change_steer_w = 1000; // 200 pretty good, 20: can't make sharpest curve
-    const double change_accel_w = 10; // 10 good
-
     // Reference State Cost
     // The part of the cost based on the reference state
-    for (size_t t = 0; t < N; ++t) {
+    for (size_t t = 0; t < h.N; ++t) {
       // High coeff = more attention paid to variables (by the cost function)
-      fg[0] += cte_w * CppAD::pow(vars[cte_start + t] - ref_cte, 2);  // cross track error
-      fg[0] += epsi_w * CppAD::pow(vars[epsi_start + t] - ref_epsi, 2);  // orientation error
-      fg[0] += v_w * CppAD::pow(vars[v_start + t] - ref_v, 2);  // velocity error
+      fg[0] += w.cte_w * CppAD::pow(vars[h.cte_start + t] - w.ref_cte, 2);  // cross track error
+      fg[0] += w.epsi_w * CppAD::pow(vars[h.epsi_start + t] - w.ref_epsi, 2);  // orientation error
+      fg[0] += w.v_w * CppAD::pow(vars[h.v_start + t] - w.ref_v, 2);  // velocity error
     }
 
     // Minimize the use of actuators
     // Minimize change-rate; constrain erratic control inputs
     // Goal is smooth turning and smooth accel/decel
-    for (size_t t = 0; t < N - 1; ++t) {
-      fg[0] += actuator_w * CppAD::pow(vars[delta_start + t], 2);
-      fg[0] += actuator_w * CppAD::pow(vars[a_start + t], 2);
+    for (size_t t = 0; t < h.N - 1; ++t) {
+      fg[0] += w.actuator_w * CppAD::pow(vars[h.delta_start + t], 2);
+      fg[0] += w.actuator_w * CppAD::pow(vars[h.a_start + t], 2);
     }
 
     // Minimize the value gap between sequential actuations
     // Make control decisions more consistent/smoother
     // The next control input should be similar to the current one
-    for (size_t t = 0; t < N - 2; ++t) {
-      fg[0] += change_steer_w * CppAD::pow(vars[delta_start + t + 1] - vars[delta_start + t], 2);
-      fg[0] += change_accel_w * CppAD::pow(vars[a_start + t + 1] - vars[a_start + t], 2);
+    for (size_t t = 0; t < h.N - 2; ++t) {
+      fg[0] += w.change_steer_w * CppAD::pow(vars[h.delta_start + t + 1] - vars[h.delta_start + t], 2);
+      fg[0] += w.change_accel_w * CppAD::pow(vars[h.a_start + t + 1] - vars[h.a_start + t], 2);
     }
 
     // Setup Constraints
@@ -97,40 +131,41 @@ class FG_eval {
     // We add 1 to each of the starting indices due to cost being located at
     // index 0 of `fg`.
     // This bumps up the position of all the other values.
-    fg[1 + x_start] = vars[x_start];
-    fg[1 + y_start] = vars[y_start];
-    fg[1 + psi_start] = vars[psi_start];
-    fg[1 + v_start] = vars[v_start];
-    fg[1 + cte_start] = vars[cte_start];
-    fg[1 + epsi_start] = vars[epsi_start];
+    fg[1 + h.x_start] = vars[h.x_start];
+    fg[1 + h.y_start] = vars[h.y_start];
+    fg[1 + h.psi_start] = vars[h.psi_start];
+    fg[1 + h.v_start] = vars[h.v_start];
+    fg[1 + h.cte_start] = vars[h.cte_start];
+    fg[1 + h.epsi_start] = vars[h.epsi_start];
 
     // The rest of the constraints
-    for (size_t t = 1; t < N; ++t) {
+    for (size_t t = 1; t < h.N; ++t) {
       // To use CppAD effectively, we have to use its types instead of standard lib types
       // Standard math operations are overloaded so calling +,-,*,/ will work if using CppAD<double>
       // The state at time t:
-      AD<double> x0 = vars[x_start + t - 1];
-      AD<double> y0 = vars[y_start + t - 1];
-      AD<double> psi0 = vars[psi_start + t - 1];
-      AD<double> v0 = vars[v_start + t - 1];
-      AD<double> cte0 = vars[cte_start + t - 1];
-      AD<double> epsi0 = vars[epsi_start + t - 1];
+      AD<double> x0 = vars[h.x_start + t - 1];
+      AD<double> y0 = vars[h.y_start + t - 1];
+      AD<double> psi0 = vars[h.psi_start + t - 1];
+      AD<double> v0 = vars[h.v_start + t - 1];
+      AD<double> cte0 = vars[h.cte_start + t - 1];
+      AD<double> epsi0 = vars[h.epsi_start + t - 1];
 
       // The state at time t + 1:
-      AD<double> x1 = vars[x_start + t];
-      AD<double> y1 = vars[y_start + t];
-      AD<double> psi1 = vars[psi_start + t];
-      AD<double> v1 = vars[v_start + t];
-      AD<double> cte1 = vars[cte_start + t];
-      AD<double> epsi1 = vars[epsi_start + t];
+      AD<double> x1 = vars[h.x_start + t];
+      AD<double> y1 = vars[h.y_start + t];
+      AD<double> psi1 = vars[h.psi_start + t];
+      AD<double> v1 = vars[h.v_start + t];
+      AD<double> cte1 = vars[h.cte_start + t];
+      AD<double> epsi1 = vars[h.epsi_start + t];
 
       // Only consider the actuation at time t
-      AD<double> delta0 = vars[delta_start + t - 1];
-      AD<double> a0 = vars[a_start + t - 1];
+      AD<double> delta0 = vars[h.delta_start + t - 1];
+      AD<double> a0 = vars[h.a_start + t - 1];
 
-      AD<double> f0 = coeffs[0] + coeffs[1] * x0 + coeffs[2] * x0 * x0 + coeffs[3] * x0 * x0 * x0;
+      AD<double> t0 = (x0 - center) / half;
+      AD<double> f0 = coeffs[0] + coeffs[1] * t0 + coeffs[2] * t0 * t0 + coeffs[3] * t0 * t0 * t0;
       // desired psi
-      AD<double> psides0 = CppAD::atan(coeffs[1] + 2 * coeffs[2] * x0 + 3 * coeffs[3] * x0 * x0);
+      AD<double> psides0 = CppAD::atan((coeffs[1] + 2 * coeffs[2] * t0 + 3 * coeffs[3] * t0 * t0) / half);
 
       // The idea here is to constrain this value to be 0.
       // CppAD can compute derivatives and pass these to the solver.
@@ -143,26 +178,361 @@ class FG_eval {
       // cte[t] = f(x[t-1]) - y[t-1] + v[t-1] * sin(epsi[t-1]) * dt
       // epsi[t] = psi[t] - psides[t-1] + v[t-1] * delta[t-1] / Lf * dt
       //
-      fg[1 + x_start + t] = x1 - (x0 + v0 * CppAD::cos(psi0) * dt);
-      fg[1 + y_start + t] = y1 - (y0 + v0 * CppAD::sin(psi0) * dt);
-      fg[1 + psi_start + t] = psi1 - (psi0 - v0 * delta0 / Lf * dt);
-      fg[1 + v_start + t] = v1 - (v0 + a0 * dt);
-      fg[1 + cte_start + t] = cte1 - ((f0 - y0) + (v0 * CppAD::sin(epsi0) * dt));
-      fg[1 + epsi_start + t] = epsi1 - ((psi0 - psides0) - v0 * delta0 / Lf * dt);
+      fg[1 + h.x_start + t] = x1 - (x0 + v0 * CppAD::cos(psi0) * h.dt);
+      fg[1 + h.y_start + t] = y1 - (y0 + v0 * CppAD::sin(psi0) * h.dt);
+      fg[1 + h.psi_start + t] = psi1 - (psi0 - v0 * delta0 / Lf * h.dt);
+      fg[1 + h.v_start + t] = v1 - (v0 + a0 * h.dt);
+      fg[1 + h.cte_start + t] = cte1 - ((f0 - y0) + (v0 * CppAD::sin(epsi0) * h.dt));
+      fg[1 + h.epsi_start + t] = epsi1 - ((psi0 - psides0) - v0 * delta0 / Lf * h.dt);
+    }
+  }
+};
+
+// The same vehicle in path coordinates: offset from the reference, heading
+// error and speed, with the reference's curvature at each step given. No
+// polynomial or atan is recorded on the tape.
+class FrenetFG_eval {
+ public:
+  // Reference curvature at each step
+  const double* curvature;
+  const FrenetHorizon& h;
+  const double Lf;
+  const MPCWeights& w;
+  FrenetFG_eval(const double* curvature, const MPCConfig& config,
+                const MPCWeights& weights)
+      : curvature(curvature),
+        h(config.frenet()),
+        Lf(config.params().Lf),
+        w(weights) {}
+
+  typedef CPPAD_TESTVECTOR(AD<double>) ADvector;
+  void operator()(ADvector& fg, const ADvector& vars) {
+    // Same costs as FG_eval, with the offset in place of cte
+    fg[0] = 0;
+    for (size_t t = 0; t < h.N; ++t) {
+      fg[0] += w.cte_w * CppAD::pow(vars[h.offset_start + t] - w.ref_cte, 2);
+      fg[0] += w.epsi_w * CppAD::pow(vars[h.heading_error_start + t] - w.ref_epsi, 2);
+      fg[0] += w.v_w * CppAD::pow(vars[h.v_start + t] - w.ref_v, 2);
+    }
+    for (size_t t = 0; t < h.N - 1; ++t) {
+      fg[0] += w.actuator_w * CppAD::pow(vars[h.delta_start + t], 2);
+      fg[0] += w.actuator_w * CppAD::pow(vars[h.a_start + t], 2);
+    }
+    for (size_t t = 0; t < h.N - 2; ++t) {
+      fg[0] += w.change_steer_w * CppAD::pow(vars[h.delta_start + t + 1] - vars[h.delta_start + t], 2);
+      fg[0] += w.change_accel_w * CppAD::pow(vars[h.a_start + t + 1] - vars[h.a_start + t], 2);
+    }
+
+    fg[1 + h.offset_start] = vars[h.offset_start];
+    fg[1 + h.heading_error_start] = vars[h.heading_error_start];
+    fg[1 + h.v_start] = vars[h.v_start];
+
+    for (size_t t = 1; t < h.N; ++t) {
+      AD<double> n0 = vars[h.offset_start + t - 1];
+      AD<double> mu0 = vars[h.heading_error_start + t - 1];
+      AD<double> v0 = vars[h.v_start + t - 1];
+      AD<double> n1 = vars[h.offset_start + t];
+      AD<double> mu1 = vars[h.heading_error_start + t];
+      AD<double> v1 = vars[h.v_start + t];
+      AD<double> delta0 = vars[h.delta_start + t - 1];
+      AD<double> a0 = vars[h.a_start + t - 1];
+      const double kappa = curvature[t - 1];
+
+      // With curvature kappa, offset n and heading error mu:
+      // s'[t] = v[t-1] * cos(mu[t-1]) / (1 - n[t-1] * kappa)
+      // n[t] = n[t-1] + v[t-1] * sin(mu[t-1]) * dt
+      // mu[t] = mu[t-1] - v[t-1] * delta[t-1] / Lf * dt - kappa * s' * dt
+      // v[t] = v[t-1] + a[t-1] * dt
+      // The car turns at -v * delta / Lf, as psi does in FG_eval; the
+      // reference turns under it at kappa per meter of progress.
+      AD<double> progress = v0 * CppAD::cos(mu0) / (1 - n0 * kappa);
+      fg[1 + h.offset_start + t] = n1 - (n0 + v0 * CppAD::sin(mu0) * h.dt);
+      fg[1 + h.heading_error_start + t] =
+          mu1 - (mu0 - v0 * delta0 / Lf * h.dt - kappa * progress * h.dt);
+      fg[1 + h.v_start + t] = v1 - (v0 + a0 * h.dt);
+    }
+  }
+};
+
+typedef CPPAD_TESTVECTOR(double) Dvector;
+
+namespace {
+
+// CppAD's Ipopt problem adapter, extended to count iterations and, when
+// tracing, to record a span per iteration.
+template <class FG>
+class SolveCallback
+    : public CppAD::ipopt::solve_callback<Dvector, typename FG::ADvector,
+                                          FG> {
+ public:
+  SolveCallback(size_t nx, size_t ng, const Dvector& xi, const Dvector& xl,
+                const Dvector& xu, const Dvector& gl, const Dvector& gu,
+                FG& fg_eval, CppAD::ipopt::solve_result<Dvector>& solution,
+                std::chrono::steady_clock::time_point deadline,
+                SolveStats* stats)
+      // One objective; record the tape once per solve and use sparse
+      // forward and reverse mode, as the "Sparse true forward/reverse"
+      // options did with CppAD::ipopt::solve
+      : CppAD::ipopt::solve_callback<Dvector, typename FG::ADvector, FG>(
+            1, nx, ng, xi, xl, xu, gl, gu, fg_eval, false, true, true,
+            solution),
+        deadline_(deadline),
+        stats_(stats),
+        iteration_start_(std::chrono::steady_clock::now()) {}
+
+  bool intermediate_callback(Ipopt::AlgorithmMode mode, Ipopt::Index iter,
+                             Ipopt::Number obj_value, Ipopt::Number inf_pr,
+                             Ipopt::Number inf_du, Ipopt::Number mu,
+                             Ipopt::Number d_norm,
+                             Ipopt::Number regularization_size,
+                             Ipopt::Number alpha_du, Ipopt::Number alpha_pr,
+                             Ipopt::Index ls_trials,
+                             const Ipopt::IpoptData* ip_data,
+                             Ipopt::IpoptCalculatedQuantities* ip_cq) {
+    stats_->iterations = iter;
+    if (TracingEnabled()) {
+      // Iteration 0 is Ipopt's setup and the starting point
+      std::chrono::steady_clock::time_point now =
+          std::chrono::steady_clock::now();
+      TraceSpan("ipopt_iteration", iteration_start_, now, iter);
+      iteration_start_ = now;
     }
+    // Past the deadline Ipopt stops with user_requested_stop and hands
+    // back this iterate
+    return deadline_ == std::chrono::steady_clock::time_point::max() ||
+           std::chrono::steady_clock::now() < deadline_;
   }
+
+ private:
+  const std::chrono::steady_clock::time_point deadline_;
+  SolveStats* stats_;
+  std::chrono::steady_clock::time_point iteration_start_;
 };
 
+// The names of CppAD::ipopt::solve_result::status_type, in order
+const char* const kStatusNames[] = {"not_defined",
+                                    "success",
+                                    "maxiter_exceeded",
+                                    "stop_at_tiny_step",
+                                    "stop_at_acceptable_point",
+                                    "local_infeasibility",
+                                    "user_requested_stop",
+                                    "feasible_point_found",
+                                    "diverging_iterates",
+                                    "restoration_failure",
+                                    "error_in_step_computation",
+                                    "invalid_number_detected",
+                                    "too_few_degrees_of_freedom",
+                                    "internal_error",
+                                    "unknown"};
+static_assert(sizeof(kStatusNames) / sizeof(kStatusNames[0]) ==
+                  MPC::kStatusCount,
+              "one name per CppAD::ipopt::solve_result status");
+static_assert(MPC::kStatusSuccess ==
+                  CppAD::ipopt::solve_result<Dvector>::success,
+              "MPC::kStatusSuccess is CppAD's success status");
+
+// Starting points. Given a plan, the states in `vars` are driven from the
+// initial state with its actuators through the model, so Ipopt starts from a
+// point meeting every constraint and only has to improve the plan.
+
+// FG_eval's model with `reference`; the initial state is already in `vars`.
+void RollOut(const Horizon& h, double Lf, const ScaledPoly& reference,
+             const double* plan, Dvector* vars) {
+  Dvector& guess = *vars;
+  const FitCoeffs& b = reference.coeffs;
+  for (size_t i = 0; i < 2 * (h.N - 1); ++i) {
+    guess[h.delta_start + i] = plan[i];
+  }
+  for (size_t t = 1; t < h.N; ++t) {
+    const double x0 = guess[h.x_start + t - 1];
+    const double y0 = guess[h.y_start + t - 1];
+    const double psi0 = guess[h.psi_start + t - 1];
+    const double v0 = guess[h.v_start + t - 1];
+    const double epsi0 = guess[h.epsi_start + t - 1];
+    const double delta0 = guess[h.delta_start + t - 1];
+    const double a0 = guess[h.a_start + t - 1];
+    const double t0 = (x0 - reference.center) / reference.half;
+    const double f0 = polyeval(b, t0);
+    const double psides0 =
+        atan(((3 * b(3) * t0 + 2 * b(2)) * t0 + b(1)) / reference.half);
+    guess[h.x_start + t] = x0 + v0 * cos(psi0) * h.dt;
+    guess[h.y_start + t] = y0 + v0 * sin(psi0) * h.dt;
+    guess[h.psi_start + t] = psi0 - v0 * delta0 / Lf * h.dt;
+    guess[h.v_start + t] = v0 + a0 * h.dt;
+    guess[h.cte_start + t] = (f0 - y0) + v0 * sin(epsi0) * h.dt;
+    guess[h.epsi_start + t] = (psi0 - psides0) - v0 * delta0 / Lf * h.dt;
+  }
+}
+
+// FrenetFG_eval's model with `curvature`, likewise.
+void RollOut(const FrenetHorizon& h, double Lf, const double* curvature,
+             const double* plan, Dvector* vars) {
+  Dvector& guess = *vars;
+  for (size_t i = 0; i < 2 * (h.N - 1); ++i) {
+    guess[h.delta_start + i] = plan[i];
+  }
+  for (size_t t = 1; t < h.N; ++t) {
+    const double n0 = guess[h.offset_start + t - 1];
+    const double mu0 = guess[h.heading_error_start + t - 1];
+    const double v0 = guess[h.v_start + t - 1];
+    const double delta0 = guess[h.delta_start + t - 1];
+    const double a0 = guess[h.a_start + t - 1];
+    const double kappa = curvature[t - 1];
+    const double progress = v0 * cos(mu0) / (1 - n0 * kappa);
+    guess[h.offset_start + t] = n0 + v0 * sin(mu0) * h.dt;
+    guess[h.heading_error_start + t] =
+        mu0 - v0 * delta0 / Lf * h.dt - kappa * progress * h.dt;
+    guess[h.v_start + t] = v0 + a0 * h.dt;
+  }
+}
+
+// The actuators of a converged `solution` from `delta_start` on into
+// `plan`, which is left empty if the solve failed.
+void KeepPlan(const CppAD::ipopt::solve_result<Dvector>& solution,
+              size_t delta_start, size_t n_vars, vector<double>* plan) {
+  plan->clear();
+  if (solution.status == CppAD::ipopt::solve_result<Dvector>::success) {
+    for (size_t i = delta_start; i < n_vars; ++i) {
+      plan->push_back(solution.x[i]);
+    }
+  }
+}
+
+// Drive Ipopt over the problem `fg_eval` describes, starting from `vars`.
+// Fills `solution`, with the starting point if Ipopt cannot start, and
+// `stats`. Ipopt prints at `print_level` and gives up after `time_limit`
+// seconds of CPU time or at `deadline`, whichever comes first.
+template <class FG>
+void RunIpopt(FG& fg_eval, size_t n_vars, size_t n_constraints,
+              const Dvector& vars, const Dvector& vars_lowerbound,
+              const Dvector& vars_upperbound,
+              const Dvector& constraints_lowerbound,
+              const Dvector& constraints_upperbound,
+              CppAD::ipopt::solve_result<Dvector>& solution,
+              int print_level, double time_limit,
+              std::chrono::steady_clock::time_point deadline,
+              SolveStats* stats) {
+  //
+  // NOTE: You don't have to worry about these options
+  //
+  // Ipopt is driven directly rather than through CppAD::ipopt::solve so
+  // the iteration count can be reported; the options are the same.
+  Ipopt::SmartPtr<Ipopt::IpoptApplication> app =
+      new Ipopt::IpoptApplication();
+  // Raise this if you'd like more print information
+  app->Options()->SetIntegerValue("print_level", print_level);
+  // NOTE: max_cpu_time is only a CPU time backstop; the wall-clock limit
+  // is `deadline`, checked every iteration, see MPC::set_deadline.
+  app->Options()->SetNumericValue("max_cpu_time", time_limit);
+  app->Options()->SetStringValue("linear_solver", linear_solver);
+
+  // Ipopt is the tool used to optimize the control inputs; it's able to find locally optimal values (non-liner problems)
+  // It keeps the constraints set directly to the actuators and the constraints defined by the vehicle model.
+  // Ipopt requires we give it the jacobians and hessians directly; it does not compute them for us.
+  // CppAD library is used for automatic differentiation; no need to manually compute derivatives
+
+  stats->iterations = 0;
+
+  // solve the problem
+  std::unique_lock<std::mutex> lock(solver_mutex, std::defer_lock);
+  if (serialize_solves) {
+    std::chrono::steady_clock::time_point wait_start =
+        std::chrono::steady_clock::now();
+    lock.lock();
+    TraceSpan("solver_lock_wait", wait_start, std::chrono::steady_clock::now());
+  }
+  if (app->Initialize() == Ipopt::Solve_Succeeded) {
+    // NOTE: Sparse forward and reverse mode (see SolveCallback) lets the
+    // solver take advantage of sparse routines, this makes the computation
+    // MUCH FASTER.
+    Ipopt::SmartPtr<Ipopt::TNLP> nlp;
+    {
+      // The callback records the tape and its sparsity patterns up front
+      PerfSection perf(kPerfTape);
+      nlp = new SolveCallback<FG>(n_vars, n_constraints, vars,
+                                  vars_lowerbound, vars_upperbound,
+                                  constraints_lowerbound,
+                                  constraints_upperbound, fg_eval, solution,
+                                  deadline, stats);
+    }
+    PerfSection perf(kPerfIpopt);
+    app->OptimizeTNLP(nlp);
+  } else {
+    // Bad options; hand back the starting point
+    solution.status = CppAD::ipopt::solve_result<Dvector>::unknown;
+    solution.x = vars;
+    solution.obj_value = 0;
+  }
+  if (lock.owns_lock()) {
+    lock.unlock();
+  }
+  PublishAllocatorStats();
+  stats->status = solution.status;
+  stats->cost = solution.obj_value;
+}
+
+}  // namespace
+
 //
 // MPC class definition implementation.
 //
-MPC::MPC() {}
+const int MPC::kStatusCount;
+const int MPC::kStatusSuccess;
+
+const char* MPC::StatusName(int status) {
+  return status >= 0 && status < kStatusCount ? kStatusNames[status]
+                                              : "unknown";
+}
+
+MPC::MPC(std::shared_ptr<const MPCConfig> config)
+    : config_(config),
+      horizon_(config_->horizon()),
+      frenet_(config_->frenet()),
+      stats_(),
+      deadline_(std::chrono::steady_clock::time_point::max()) {}
 MPC::~MPC() {}
 
-vector<double> MPC::Solve(Eigen::VectorXd state, Eigen::VectorXd coeffs) {
-  bool ok = true;
+void MPC::SetupThreads(size_t num_threads, const std::string& solver) {
+  main_thread_id = std::this_thread::get_id();
+  linear_solver = solver;
+  serialize_solves = solver == "mumps" && num_threads > 1;
+  // CppAD keeps per-thread tape and memory pools; it must know how many
+  // threads can record tapes and how to tell them apart.
+  num_cppad_threads = num_threads + 1;
+  allocator_slots.reset(new AllocatorSlot[num_cppad_threads]());
+  CppAD::thread_alloc::parallel_setup(num_cppad_threads, InParallel,
+                                      ThreadNumber);
+  CppAD::parallel_ad<double>();
+}
 
-  typedef CPPAD_TESTVECTOR(double) Dvector;
+bool MPC::ParseModel(const std::string& name, Model* model) {
+  if (name == "cartesian") {
+    *model = kCartesian;
+  } else if (name == "frenet") {
+    *model = kFrenet;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+void MPC::AllocatorStats(size_t* inuse, size_t* available) {
+  *inuse = 0;
+  *available = 0;
+  for (size_t thread = 0; thread < num_cppad_threads; ++thread) {
+    *inuse += allocator_slots[thread].inuse.load(std::memory_order_relaxed);
+    *available +=
+        allocator_slots[thread].available.load(std::memory_order_relaxed);
+  }
+}
+
+bool MPC::Solve(const double* state, const ScaledPoly& reference,
+                const double* plan, const MPCWeights* weights,
+                ControlResult* result) {
+  const std::chrono::steady_clock::time_point start =
+      std::chrono::steady_clock::now();
+  bool ok = true;
 
   // TODO: Set the number of model variables (includes both states and inputs).
   // For example: If the state is a 4 element vector, the actuators are a
@@ -175,10 +545,10 @@ vector<double> MPC::Solve(Eigen::VectorXd state, Eigen::VectorXd coeffs) {
   double cte = state[4];
   double epsi = state[5];
 
-  size_t n_vars = N * 6 + (N -1) * 2;
+  size_t n_vars = horizon_.n_vars;
 
   // TODO: Set the number of constraints
-  size_t n_constraints = N * 6;
+  size_t n_constraints = horizon_.n_constraints;
 
   // Initial value of the independent variables.
   // SHOULD BE 0 besides initial state.
@@ -198,27 +568,27 @@ vector<double> MPC::Solve(Eigen::VectorXd state, Eigen::VectorXd coeffs) {
 
   // Set all non-actuators upper and lower limits
   // to the max negative and positive values.
-  for (size_t i = 0; i < delta_start; ++i) {
+  for (size_t i = 0; i < horizon_.delta_start; ++i) {
     vars_lowerbound[i] = -numeric_limits<float>::max();
     vars_upperbound[i] = +numeric_limits<float>::max();
   }
 
   // The upper and lower limits of delta are set to -25 and 25
-  // degrees (values in radians)
-  double max_degrees = 25;
-  double max_radians = max_degrees * M_PI / 180;
+  // degrees (values in radians) by default; see MPCParams::max_steer
+  const MPCParams& params = config_->params();
+  double max_radians = params.max_steer;
 
   //std::cout << "lower" << -max_radians << "\n";
   //std::cout << "upper" << +max_radians << "\n";
-  for (size_t i = delta_start; i < a_start; ++i) {
+  for (size_t i = horizon_.delta_start; i < horizon_.a_start; ++i) {
     vars_lowerbound[i] = -max_radians;
     vars_upperbound[i] = +max_radians;
   }
 
   // Acceleration/deceleration upper and lower limits
-  for (size_t i = a_start; i < n_vars; ++i) {
-    vars_lowerbound[i] = -1.0;
-    vars_upperbound[i] = 1.0;
+  for (size_t i = horizon_.a_start; i < n_vars; ++i) {
+    vars_lowerbound[i] = -params.max_accel;
+    vars_upperbound[i] = params.max_accel;
   }
 
 
@@ -231,75 +601,157 @@ vector<double> MPC::Solve(Eigen::VectorXd state, Eigen::VectorXd coeffs) {
   }
 
   // Force solver to start from current state in optimization
-  constraints_lowerbound[x_start] = x;
-  constraints_lowerbound[y_start] = y;
-  constraints_lowerbound[psi_start] = psi;
-  constraints_lowerbound[v_start] = v;
-  constraints_lowerbound[cte_start] = cte;
-  constraints_lowerbound[epsi_start] = epsi;
-
-  constraints_upperbound[x_start] = x;
-  constraints_upperbound[y_start] = y;
-  constraints_upperbound[psi_start] = psi;
-  constraints_upperbound[v_start] = v;
-  constraints_upperbound[cte_start] = cte;
-  constraints_upperbound[epsi_start] = epsi;
-
+  constraints_lowerbound[horizon_.x_start] = x;
+  constraints_lowerbound[horizon_.y_start] = y;
+  constraints_lowerbound[horizon_.psi_start] = psi;
+  constraints_lowerbound[horizon_.v_start] = v;
+  constraints_lowerbound[horizon_.cte_start] = cte;
+  constraints_lowerbound[horizon_.epsi_start] = epsi;
+
+  constraints_upperbound[horizon_.x_start] = x;
+  constraints_upperbound[horizon_.y_start] = y;
+  constraints_upperbound[horizon_.psi_start] = psi;
+  constraints_upperbound[horizon_.v_start] = v;
+  constraints_upperbound[horizon_.cte_start] = cte;
+  constraints_upperbound[horizon_.epsi_start] = epsi;
+
+
+  if (plan != nullptr) {
+    vars[horizon_.x_start] = x;
+    vars[horizon_.y_start] = y;
+    vars[horizon_.psi_start] = psi;
+    vars[horizon_.v_start] = v;
+    vars[horizon_.cte_start] = cte;
+    vars[horizon_.epsi_start] = epsi;
+    RollOut(horizon_, params.Lf, reference, plan, &vars);
+  }
 
   // object that computes objective and constraints
-  FG_eval fg_eval(coeffs);
-
-  //
-  // NOTE: You don't have to worry about these options
-  //
-  // options for IPOPT solver
-  std::string options;
-  // Uncomment this if you'd like more print information
-  options += "Integer print_level  0\n";
-  // NOTE: Setting sparse to true allows the solver to take advantage
-  // of sparse routines, this makes the computation MUCH FASTER. If you
-  // can uncomment 1 of these and see if it makes a difference or not but
-  // if you uncomment both the computation time should go up in orders of
-  // magnitude.
-  options += "Sparse  true        forward\n";
-  options += "Sparse  true        reverse\n";
-  // NOTE: Currently the solver has a maximum time limit of 0.5 seconds.
-  // Change this as you see fit.
-  options += "Numeric max_cpu_time          0.5\n";
-
-  // Ipopt is the tool used to optimize the control inputs; it's able to find locally optimal values (non-liner problems)
-  // It keeps the constraints set directly to the actuators and the constraints defined by the vehicle model.
-  // Ipopt requires we give it the jacobians and hessians directly; it does not compute them for us.
-  // CppAD library is used for automatic differentiation; no need to manually compute derivatives
+  FG_eval fg_eval(reference, *config_,
+                  weights != nullptr ? *weights : params.weights);
 
   // place to return solution
   CppAD::ipopt::solve_result<Dvector> solution;
-
-  // solve the problem
-  CppAD::ipopt::solve<Dvector, FG_eval>(
-      options, vars, vars_lowerbound, vars_upperbound, constraints_lowerbound,
-      constraints_upperbound, fg_eval, solution);
+  RunIpopt(fg_eval, n_vars, n_constraints, vars, vars_lowerbound,
+           vars_upperbound, constraints_lowerbound, constraints_upperbound,
+           solution, params.print_level, params.max_cpu_time, deadline_,
+           &stats_);
+  KeepPlan(solution, horizon_.delta_start, n_vars, &last_plan_);
 
   // Check some of the solution values
   ok &= solution.status == CppAD::ipopt::solve_result<Dvector>::success;
 
-  // Cost
-  auto cost = solution.obj_value;
-  std::cout << "Cost " << cost << std::endl;
-
   // TODO: Return the first actuator values. The variables can be accessed with `solution.x[i]`.
-  //
-  // {...} is shorthand for creating a vector, so auto x1 = {1.0,2.0}
-  // creates a 2 element double vector.
-  vector<double> result;
+  result->steer = solution.x[horizon_.delta_start];
+  result->throttle = solution.x[horizon_.a_start];
+
+  // The whole horizon, states and actuators
+  result->steps = horizon_.N;
+  for (size_t t = 0; t < horizon_.N; ++t) {
+    result->x[t] = solution.x[horizon_.x_start + t];
+    result->y[t] = solution.x[horizon_.y_start + t];
+    result->psi[t] = solution.x[horizon_.psi_start + t];
+    result->v[t] = solution.x[horizon_.v_start + t];
+    result->cte[t] = solution.x[horizon_.cte_start + t];
+    result->epsi[t] = solution.x[horizon_.epsi_start + t];
+  }
+  for (size_t t = 0; t < horizon_.N - 1; ++t) {
+    result->delta[t] = solution.x[horizon_.delta_start + t];
+    result->a[t] = solution.x[horizon_.a_start + t];
+  }
 
-  result.push_back(solution.x[delta_start]);
-  result.push_back(solution.x[a_start]);
+  stats_.seconds = std::chrono::duration<double>(
+                       std::chrono::steady_clock::now() - start)
+                       .count();
+  result->stats = stats_;
+  return ok;
+}
 
-  for (size_t i = 0; i < N - 1; i++) {
-    result.push_back(solution.x[x_start + i + 1]);
-    result.push_back(solution.x[y_start + i + 1]);
+bool MPC::SolveFrenet(const FrenetState& state, const double* curvature,
+                      const double* plan, const MPCWeights* weights,
+                      ControlResult* result) {
+  const std::chrono::steady_clock::time_point start =
+      std::chrono::steady_clock::now();
+  const FrenetHorizon& h = frenet_;
+  Dvector vars(h.n_vars);
+  Dvector vars_lowerbound(h.n_vars);
+  Dvector vars_upperbound(h.n_vars);
+  for (size_t i = 0; i < h.n_vars; ++i) {
+    vars[i] = 0.0;
+  }
+  // States unbounded; actuators as in Solve
+  const MPCParams& params = config_->params();
+  const double max_radians = params.max_steer;
+  for (size_t i = 0; i < h.delta_start; ++i) {
+    vars_lowerbound[i] = -numeric_limits<float>::max();
+    vars_upperbound[i] = +numeric_limits<float>::max();
+  }
+  for (size_t i = h.delta_start; i < h.a_start; ++i) {
+    vars_lowerbound[i] = -max_radians;
+    vars_upperbound[i] = +max_radians;
+  }
+  for (size_t i = h.a_start; i < h.n_vars; ++i) {
+    vars_lowerbound[i] = -params.max_accel;
+    vars_upperbound[i] = params.max_accel;
+  }
+
+  // Dynamics hold exactly; the first step is the current state
+  Dvector constraints_lowerbound(h.n_constraints);
+  Dvector constraints_upperbound(h.n_constraints);
+  for (size_t i = 0; i < h.n_constraints; ++i) {
+    constraints_lowerbound[i] = 0;
+    constraints_upperbound[i] = 0;
+  }
+  constraints_lowerbound[h.offset_start] = state.offset;
+  constraints_upperbound[h.offset_start] = state.offset;
+  constraints_lowerbound[h.heading_error_start] = state.heading_error;
+  constraints_upperbound[h.heading_error_start] = state.heading_error;
+  constraints_lowerbound[h.v_start] = state.v;
+  constraints_upperbound[h.v_start] = state.v;
+
+  if (plan != nullptr) {
+    vars[h.offset_start] = state.offset;
+    vars[h.heading_error_start] = state.heading_error;
+    vars[h.v_start] = state.v;
+    RollOut(h, params.Lf, curvature, plan, &vars);
+  }
+
+  FrenetFG_eval fg_eval(curvature, *config_,
+                        weights != nullptr ? *weights : params.weights);
+  CppAD::ipopt::solve_result<Dvector> solution;
+  RunIpopt(fg_eval, h.n_vars, h.n_constraints, vars, vars_lowerbound,
+           vars_upperbound, constraints_lowerbound, constraints_upperbound,
+           solution, params.print_level, params.max_cpu_time, deadline_,
+           &stats_);
+  KeepPlan(solution, h.delta_start, h.n_vars, &last_plan_);
+
+  result->steer = solution.x[h.delta_start];
+  result->throttle = solution.x[h.a_start];
+
+  // The predicted path in the car's frame, driven from the given pose with
+  // the solved speeds and steering; the errors as solved
+  result->steps = h.N;
+  result->x[0] = state.x;
+  result->y[0] = state.y;
+  result->psi[0] = state.psi;
+  for (size_t t = 0; t < h.N; ++t) {
+    result->v[t] = solution.x[h.v_start + t];
+    result->cte[t] = -solution.x[h.offset_start + t];
+    result->epsi[t] = solution.x[h.heading_error_start + t];
+  }
+  for (size_t t = 0; t < h.N - 1; ++t) {
+    const double v = result->v[t];
+    const double psi = result->psi[t];
+    result->delta[t] = solution.x[h.delta_start + t];
+    result->a[t] = solution.x[h.a_start + t];
+    result->x[t + 1] = result->x[t] + v * cos(psi) * h.dt;
+    result->y[t + 1] = result->y[t] + v * sin(psi) * h.dt;
+    result->psi[t + 1] = psi - v * result->delta[t] / params.Lf * h.dt;
   }
 
-  return result;
+  stats_.seconds = std::chrono::duration<double>(
+                       std::chrono::steady_clock::now() - start)
+                       .count();
+  result->stats = stats_;
+  return solution.status == CppAD::ipopt::solve_result<Dvector>::success;
 }
@@ -1,20 +1,151 @@
 #ifndef MPC_H
 #define MPC_H
 
+#include <chrono>
+#include <memory>
+#include <string>
 #include <vector>
 #include "Eigen-3.3/Eigen/Core"
+#include "mpc_config.h"
+#include "polynomial.h"
 
 using namespace std;
 
+// The car relative to the reference line, for MPC::SolveFrenet.
+struct FrenetState {
+  // Distance from the reference, positive to its left
+  double offset;
+  // Heading minus the reference's heading, radians
+  double heading_error;
+  double v;
+  // Pose in the car's frame the predicted path is drawn from
+  double x;
+  double y;
+  double psi;
+};
+
+// Outcome of one MPC::Solve.
+struct SolveStats {
+  // CppAD::ipopt::solve_result status code; see MPC::StatusName
+  int status;
+  // Ipopt iterations, 0 if Ipopt never started
+  int iterations;
+  // Objective value at the returned solution
+  double cost;
+  // Wall time of the whole solve, setup and taping included, in seconds
+  double seconds;
+};
+
+// Everything a solve settled on, over the whole horizon. The arrays are
+// sized for the longest horizon, so a result is filled in place without
+// allocating; index t is step t of the horizon.
+struct ControlResult {
+  // Longest horizon a result holds, and so an MPC can be built with
+  static const size_t kMaxSteps = 32;
+
+  // First steering angle (radians, positive to the right as the simulator
+  // steers) and acceleration
+  double steer;
+  double throttle;
+  // Steps filled in below
+  size_t steps;
+  // Predicted state at each step, starting with the one solved from: pose
+  // in the car's frame, speed, and cross track and heading errors against
+  // the reference
+  double x[kMaxSteps];
+  double y[kMaxSteps];
+  double psi[kMaxSteps];
+  double v[kMaxSteps];
+  double cte[kMaxSteps];
+  double epsi[kMaxSteps];
+  // Steering and acceleration from each step to the next: steps - 1 of each
+  double delta[kMaxSteps];
+  double a[kMaxSteps];
+  SolveStats stats;
+};
+
 class MPC {
  public:
-  MPC();
+  // An MPC with the horizon, model, costs, bounds and Ipopt settings of
+  // `config`.
+  explicit MPC(std::shared_ptr<const MPCConfig> config = MPCConfig::Default());
 
   virtual ~MPC();
 
-  // Solve the model given an initial state and polynomial coefficients.
-  // Return the first actuatotions.
-  vector<double> Solve(Eigen::VectorXd state, Eigen::VectorXd coeffs);
+  // Which model a session solves: the car's pose and errors against the
+  // fitted polynomial (Solve), or its offset and heading error along the
+  // reference (SolveFrenet).
+  enum Model { kCartesian, kFrenet };
+
+  // Solve the model given an initial state, [x, y, psi, v, cte, epsi], and
+  // the reference in the fit's scaled basis, which the model evaluates
+  // directly. With a `plan`, laid out as last_plan(), the solver starts from
+  // it instead of from rest. The cost uses `weights`, or the config's if
+  // null; each solve records its tape anyway, so weights that change from
+  // one solve to the next cost no extra work. Fills `result`, with wherever the
+  // solver stopped if it did not converge, and returns whether it did.
+  bool Solve(const double* state, const ScaledPoly& reference,
+             const double* plan, const MPCWeights* weights,
+             ControlResult* result);
+
+  // Solve the model in path coordinates. Progress along the reference
+  // follows from the speed, so the state is just the offset, heading error
+  // and speed, and the reference enters only as `curvature`: N values, its
+  // curvature (1/m, positive turning left) where the car is predicted to be
+  // at each step. Fills `result` as Solve does, with the predicted pose
+  // rolled out in the car's frame from `state`'s, the cross track error
+  // minus the offset and the heading error as solved. `plan` and `weights`
+  // as for Solve.
+  bool SolveFrenet(const FrenetState& state, const double* curvature,
+                   const double* plan, const MPCWeights* weights,
+                   ControlResult* result);
+
+  const MPCConfig& config() const { return *config_; }
+  size_t steps() const { return horizon_.N; }
+  double dt() const { return horizon_.dt; }
+
+  // Wall time by which later solves stop and return what they have, none
+  // (time_point::max()) to begin with. Checked at every Ipopt iteration, so
+  // it also counts time spent waiting for the solver lock or recording the
+  // tape; a solve whose deadline passed before Ipopt started stops at its
+  // starting point.
+  void set_deadline(std::chrono::steady_clock::time_point deadline) {
+    deadline_ = deadline;
+  }
+
+  // Actuators the last solve settled on: N - 1 steering angles, then N - 1
+  // accelerations. Empty if it did not converge.
+  const vector<double>& last_plan() const { return last_plan_; }
+
+  // Number of distinct SolveStats::status codes and the name of each, e.g.
+  // "success" or "maxiter_exceeded".
+  static const int kStatusCount = 15;
+  static const char* StatusName(int status);
+  // The SolveStats::status code of a solve that converged.
+  static const int kStatusSuccess = 1;
+
+  // Prepare CppAD for `num_threads` solver threads and pick Ipopt's linear
+  // solver. Call once from the main thread before any other thread uses an
+  // MPC. With "mumps", which is not thread safe, Ipopt calls from different
+  // threads are made one at a time; HSL solvers such as "ma27" run in
+  // parallel.
+  static void SetupThreads(size_t num_threads, const string& linear_solver);
+
+  // Bytes held by CppAD's per-thread allocator across all solver threads:
+  // in use by tapes and vectors, and cached for reuse, as each thread saw
+  // them after its last solve. Safe from any thread; never calls CppAD.
+  static void AllocatorStats(size_t* inuse, size_t* available);
+
+  // "cartesian" or "frenet". Returns false for other names.
+  static bool ParseModel(const string& name, Model* model);
+
+ private:
+  const std::shared_ptr<const MPCConfig> config_;
+  const Horizon& horizon_;
+  const FrenetHorizon& frenet_;
+  SolveStats stats_;
+  vector<double> last_plan_;
+  std::chrono::steady_clock::time_point deadline_;
 };
 
 #endif /* MPC_H */
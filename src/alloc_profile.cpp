@@ -0,0 +1,285 @@
+#include "alloc_profile.h"
+#include <unistd.h>
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <iomanip>
+#include <new>
+#include <sstream>
+
+#if defined(MPC_ALLOC_PROFILE) && defined(__GLIBC__)
+#include <malloc.h>
+
+// glibc's allocator under the names the interposed functions forward to
+extern "C" {
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t n, size_t size);
+void* __libc_realloc(void* p, size_t size);
+void* __libc_memalign(size_t alignment, size_t size);
+}
+#endif
+
+namespace {
+
+#ifdef MPC_ALLOC_PROFILE
+
+// One bit per Stage that must not allocate once warm
+std::atomic<uint32_t> no_heap_stages(0);
+
+// Plain data with a constant initializer: operator new runs before the
+// thread's dynamically initialized thread-locals exist and after they are
+// gone.
+struct ThreadAllocs {
+  uint64_t count;
+  uint64_t bytes;
+  // Counts at the last stage boundary and at the start of the message
+  uint64_t stage_count;
+  uint64_t stage_bytes;
+  uint64_t message_count;
+  // Current stage, kStageCount outside a message or after its last stage
+  int stage;
+  int last_stage;
+  // Past the session's warm-up
+  bool warm;
+  // Allocating now aborts
+  bool strict;
+};
+
+thread_local ThreadAllocs allocs = {0, 0, 0, 0, 0, kStageCount, kStageCount,
+                                    false, false};
+
+struct StageAllocs {
+  std::atomic<uint64_t> count;
+  std::atomic<uint64_t> bytes;
+};
+
+StageAllocs stage_allocs[kStageCount];
+std::atomic<uint64_t> messages(0);
+std::atomic<uint64_t> max_message_count(0);
+
+// Called from the allocator: must not allocate itself.
+void NoHeapViolation(size_t size) {
+  allocs.strict = false;
+  char line[128];
+  int n = snprintf(line, sizeof(line),
+                   "Heap allocation of %zu bytes in no-heap stage %s\n", size,
+                   StageName(static_cast<Stage>(allocs.stage)));
+  if (n > 0) {
+    ssize_t ignored = write(STDERR_FILENO, line, n);
+    (void)ignored;
+  }
+  abort();
+}
+
+void CountAllocation(size_t size) {
+  ++allocs.count;
+  allocs.bytes += size;
+  if (allocs.strict) {
+    NoHeapViolation(size);
+  }
+}
+
+#ifndef __GLIBC__
+void* Allocate(size_t size) {
+  CountAllocation(size);
+  while (true) {
+    void* p = malloc(size == 0 ? 1 : size);
+    if (p != nullptr) {
+      return p;
+    }
+    std::new_handler handler = std::get_new_handler();
+    if (handler == nullptr) {
+      throw std::bad_alloc();
+    }
+    handler();
+  }
+}
+
+void* AllocateNoThrow(size_t size) noexcept {
+  try {
+    return Allocate(size);
+  } catch (...) {
+    return nullptr;
+  }
+}
+#endif
+
+void ChargeStage(int stage) {
+  if (stage < kStageCount) {
+    stage_allocs[stage].count.fetch_add(allocs.count - allocs.stage_count,
+                                        std::memory_order_relaxed);
+    stage_allocs[stage].bytes.fetch_add(allocs.bytes - allocs.stage_bytes,
+                                        std::memory_order_relaxed);
+  }
+  allocs.stage_count = allocs.count;
+  allocs.stage_bytes = allocs.bytes;
+}
+
+void EnterStage(int stage) {
+  allocs.stage = stage;
+  allocs.strict =
+      allocs.warm && stage < kStageCount &&
+      (no_heap_stages.load(std::memory_order_relaxed) >> stage & 1) != 0;
+}
+
+#endif
+
+}  // namespace
+
+#ifdef MPC_ALLOC_PROFILE
+
+#ifdef __GLIBC__
+// With glibc the whole malloc family is interposed, which also counts
+// Eigen's aligned buffers and Fortran/C code (MUMPS) that never goes through
+// operator new. free and the rest stay glibc's.
+extern "C" {
+
+void* malloc(size_t size) noexcept {
+  CountAllocation(size);
+  return __libc_malloc(size);
+}
+
+void* calloc(size_t n, size_t size) noexcept {
+  CountAllocation(n * size);
+  return __libc_calloc(n, size);
+}
+
+void* realloc(void* p, size_t size) noexcept {
+  CountAllocation(size);
+  return __libc_realloc(p, size);
+}
+
+void* memalign(size_t alignment, size_t size) noexcept {
+  CountAllocation(size);
+  return __libc_memalign(alignment, size);
+}
+
+void* aligned_alloc(size_t alignment, size_t size) noexcept {
+  CountAllocation(size);
+  return __libc_memalign(alignment, size);
+}
+
+int posix_memalign(void** p, size_t alignment, size_t size) noexcept {
+  if (alignment % sizeof(void*) != 0 ||
+      (alignment & (alignment - 1)) != 0) {
+    return EINVAL;
+  }
+  CountAllocation(size);
+  void* result = __libc_memalign(alignment, size);
+  if (result == nullptr) {
+    return ENOMEM;
+  }
+  *p = result;
+  return 0;
+}
+
+}  // extern "C"
+#else
+// Elsewhere only operator new is counted
+void* operator new(size_t size) { return Allocate(size); }
+void* operator new[](size_t size) { return Allocate(size); }
+void* operator new(size_t size, const std::nothrow_t&) noexcept {
+  return AllocateNoThrow(size);
+}
+void* operator new[](size_t size, const std::nothrow_t&) noexcept {
+  return AllocateNoThrow(size);
+}
+void operator delete(void* p) noexcept { free(p); }
+void operator delete[](void* p) noexcept { free(p); }
+void operator delete(void* p, const std::nothrow_t&) noexcept { free(p); }
+void operator delete[](void* p, const std::nothrow_t&) noexcept { free(p); }
+#endif
+
+void EndAllocStage(Stage stage) {
+  ChargeStage(stage);
+  EnterStage(stage < allocs.last_stage ? stage + 1 : kStageCount);
+}
+
+AllocMessageScope::AllocMessageScope(Stage first, Stage last,
+                                     uint64_t index) {
+  allocs.stage_count = allocs.count;
+  allocs.stage_bytes = allocs.bytes;
+  allocs.message_count = allocs.count;
+  allocs.last_stage = last;
+  allocs.warm = index >= kAllocWarmupMessages;
+  EnterStage(first);
+}
+
+AllocMessageScope::~AllocMessageScope() {
+  // Whatever the message did after its last stage boundary (an early
+  // return, verbose output) belongs to the stage it was in
+  ChargeStage(allocs.stage);
+  allocs.warm = false;
+  allocs.last_stage = kStageCount;
+  EnterStage(kStageCount);
+  const uint64_t count = allocs.count - allocs.message_count;
+  messages.fetch_add(1, std::memory_order_relaxed);
+  uint64_t max = max_message_count.load(std::memory_order_relaxed);
+  while (count > max &&
+         !max_message_count.compare_exchange_weak(
+             max, count, std::memory_order_relaxed)) {
+  }
+}
+
+#endif
+
+bool SetNoHeapStages(const std::string& stages, std::string* error) {
+#ifdef MPC_ALLOC_PROFILE
+  uint32_t mask = 0;
+  std::istringstream in(stages);
+  std::string name;
+  while (std::getline(in, name, ',')) {
+    if (name == "all") {
+      mask = (1u << kStageCount) - 1;
+      continue;
+    }
+    int stage = 0;
+    while (stage < kStageCount &&
+           name != StageName(static_cast<Stage>(stage))) {
+      ++stage;
+    }
+    if (stage == kStageCount) {
+      *error = "Unknown stage: " + name;
+      return false;
+    }
+    mask |= 1u << stage;
+  }
+  no_heap_stages.store(mask, std::memory_order_relaxed);
+  return true;
+#else
+  (void)stages;
+  *error = "No-heap stages need a build with -DMPC_ALLOC_PROFILE=ON";
+  return false;
+#endif
+}
+
+void PrintAllocReport(std::ostream& out) {
+#ifdef MPC_ALLOC_PROFILE
+  const uint64_t n = messages.load(std::memory_order_relaxed);
+  std::ios::fmtflags flags = out.flags();
+  std::streamsize precision = out.precision();
+  out << "heap allocations per message (" << n << " messages, at most "
+      << max_message_count.load(std::memory_order_relaxed) << " in one)"
+      << std::endl;
+  out << std::left << std::setw(12) << "stage" << std::right << std::setw(12)
+      << "allocs" << std::setw(12) << "bytes" << std::endl;
+  out << std::fixed << std::setprecision(1);
+  for (int stage = 0; stage < kStageCount; ++stage) {
+    const uint64_t count =
+        stage_allocs[stage].count.load(std::memory_order_relaxed);
+    if (count == 0) {
+      continue;
+    }
+    const uint64_t bytes =
+        stage_allocs[stage].bytes.load(std::memory_order_relaxed);
+    out << std::left << std::setw(12) << StageName(static_cast<Stage>(stage))
+        << std::right << std::setw(12) << static_cast<double>(count) / n
+        << std::setw(12) << static_cast<double>(bytes) / n << std::endl;
+  }
+  out.flags(flags);
+  out.precision(precision);
+#else
+  (void)out;
+#endif
+}
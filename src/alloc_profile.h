@@ -0,0 +1,65 @@
+#ifndef ALLOC_PROFILE_H
+#define ALLOC_PROFILE_H
+
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include "latency_histogram.h"
+
+// Heap allocation counts per pipeline stage and per message.
+//
+// Configured with -DMPC_ALLOC_PROFILE=ON, the build interposes the
+// allocator and counts every allocation of the calling thread: ours, json's,
+// Eigen temporaries, CppAD tapes and Ipopt's. With glibc that is the malloc
+// family, so C and Fortran code (MUMPS) is included; elsewhere the global
+// operator new and delete are replaced, which misses Eigen and C code. Inside
+// an AllocMessageScope the allocations are charged to the stage the thread
+// is in and to the message.
+//
+// Strict mode (SetNoHeapStages) aborts on the first allocation in one of the
+// chosen stages once the session is past warm-up, so the core dump has the
+// allocating stack.
+//
+// In normal builds the hooks are empty inline functions and nothing is
+// counted.
+
+// Messages of a session that strict mode lets allocate: buffers, tapes and
+// Ipopt's structures reach their steady-state size over the first few.
+const uint64_t kAllocWarmupMessages = 10;
+
+#ifdef MPC_ALLOC_PROFILE
+
+// Charge the calling thread's allocations since the last stage boundary to
+// `stage` and start the next stage in pipeline order.
+void EndAllocStage(Stage stage);
+
+// Counts the allocations of one message on the calling thread, which runs
+// the stages `first` through `last`. `index` is the message's position in
+// its session, for the warm-up.
+class AllocMessageScope {
+ public:
+  AllocMessageScope(Stage first, Stage last, uint64_t index);
+  ~AllocMessageScope();
+};
+
+#else
+
+inline void EndAllocStage(Stage) {}
+
+class AllocMessageScope {
+ public:
+  AllocMessageScope(Stage, Stage, uint64_t) {}
+};
+
+#endif
+
+// Make the comma separated stages ("fit,serialize", or "all") abort on
+// allocation. Returns false with `error` set on unknown stages or in builds
+// without MPC_ALLOC_PROFILE.
+bool SetNoHeapStages(const std::string& stages, std::string* error);
+
+// Allocations and bytes per message of every stage, one line per stage.
+// Prints nothing in builds without MPC_ALLOC_PROFILE.
+void PrintAllocReport(std::ostream& out);
+
+#endif /* ALLOC_PROFILE_H */
@@ -0,0 +1,52 @@
+#include "controller.h"
+
+namespace {
+
+// The CppAD+Ipopt MPC. Each problem's deadline stops Ipopt on wall time;
+// the config's max_cpu_time stays in force as a CPU time backstop.
+class IpoptController : public Controller {
+ public:
+  explicit IpoptController(std::shared_ptr<const MPCConfig> config)
+      : mpc_(config) {}
+
+  bool Solve(const ControlProblem& problem, ControlResult* result) override {
+    mpc_.set_deadline(problem.deadline);
+
+    if (problem.model == MPC::kFrenet) {
+      return mpc_.SolveFrenet(problem.frenet, problem.curvature, problem.plan,
+                              problem.weights, result);
+    }
+    return mpc_.Solve(problem.state, problem.reference, problem.plan,
+                      problem.weights, result);
+  }
+
+  const std::vector<double>& last_plan() const override {
+    return mpc_.last_plan();
+  }
+
+  size_t steps() const override { return mpc_.steps(); }
+  double dt() const override { return mpc_.dt(); }
+
+ private:
+  MPC mpc_;
+};
+
+}  // namespace
+
+std::unique_ptr<Controller> Controller::Create(
+    Backend backend, std::shared_ptr<const MPCConfig> config) {
+  switch (backend) {
+    case kIpopt:
+    default:
+      return std::unique_ptr<Controller>(new IpoptController(config));
+  }
+}
+
+bool Controller::ParseBackend(const std::string& name, Backend* backend) {
+  if (name == "ipopt") {
+    *backend = kIpopt;
+  } else {
+    return false;
+  }
+  return true;
+}
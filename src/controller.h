@@ -0,0 +1,68 @@
+#ifndef CONTROLLER_H
+#define CONTROLLER_H
+
+#include <chrono>
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <vector>
+#include "MPC.h"
+#include "mpc_config.h"
+#include "polynomial.h"
+
+// One control cycle's problem: the car after the actuator delay, in its own
+// frame, and the reference to follow.
+struct ControlProblem {
+  // Formulation to solve; picks which of the inputs below are used
+  MPC::Model model;
+  // kCartesian: [x, y, psi, v, cte, epsi] and the fitted reference
+  double state[6];
+  ScaledPoly reference;
+  // kFrenet: the state along the reference and its curvature at each of
+  // the controller's steps() steps
+  FrenetState frenet;
+  const double* curvature;
+  // Plan to start from, laid out as Controller::last_plan(), or null
+  const double* plan;
+  // Cost references and weights to solve with, or null for the config's
+  const MPCWeights* weights;
+  // Wall time when the actuations are needed; a controller that cannot
+  // converge by then returns the best it has. Time it spends waiting, e.g.
+  // for a solver lock, counts. time_point::max() for no deadline.
+  std::chrono::steady_clock::time_point deadline;
+};
+
+// A control law behind a common interface, so the server, mpc_replay and
+// mpc_bench can run any of them. An instance belongs to one session and
+// one thread at a time.
+class Controller {
+ public:
+  // Implementations to choose from; see Create().
+  enum Backend {
+    // The MPC in MPC.h: CppAD taped model, solved by Ipopt
+    kIpopt,
+  };
+
+  virtual ~Controller() {}
+
+  // A `backend` controller with the horizon, model and costs of `config`.
+  static std::unique_ptr<Controller> Create(
+      Backend backend, std::shared_ptr<const MPCConfig> config);
+
+  // "ipopt". Returns false for other names.
+  static bool ParseBackend(const std::string& name, Backend* backend);
+
+  // Solve `problem` into `result`, in place. Returns false if the solve did
+  // not converge; `result` then holds the controller's fallback.
+  virtual bool Solve(const ControlProblem& problem, ControlResult* result) = 0;
+
+  // Actuators the last converged solve settled on: steps() - 1 steering
+  // angles, then steps() - 1 accelerations. Empty if the last solve did not
+  // converge.
+  virtual const std::vector<double>& last_plan() const = 0;
+
+  virtual size_t steps() const = 0;
+  virtual double dt() const = 0;
+};
+
+#endif /* CONTROLLER_H */
@@ -0,0 +1,334 @@
+#include "flight_recorder.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+const char FlightLogFormat::kFileMagic[8] = {'M', 'P', 'C', 'L', 'O', 'G', '1', '\0'};
+const char FlightLogFormat::kFooterMagic[8] = {'M', 'P', 'C', 'I', 'D', 'X', '1', '\0'};
+
+namespace {
+
+int64_t NowNs(bool wall) {
+  if (wall) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::system_clock::now().time_since_epoch())
+        .count();
+  }
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+}  // namespace
+
+//
+// FlightRecorder
+//
+FlightRecorder::FlightRecorder()
+    : file_(nullptr), offset_(0), frame_count_(0), block_() {}
+
+FlightRecorder::~FlightRecorder() { Close(); }
+
+bool FlightRecorder::Open(const std::string& path) {
+  Close();
+  file_ = fopen(path.c_str(), "wb");
+  if (file_ == nullptr) {
+    return false;
+  }
+
+  FlightLogFormat::FileHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, FlightLogFormat::kFileMagic, sizeof(header.magic));
+  header.version = FlightLogFormat::kVersion;
+  header.start_wall_ns = NowNs(true);
+  header.start_steady_ns = NowNs(false);
+  fwrite(&header, sizeof(header), 1, file_);
+  fflush(file_);
+
+  offset_ = sizeof(header);
+  frame_count_ = 0;
+  index_.clear();
+  raw_.reserve(2 * kBlockSize);
+  raw_.clear();
+  memset(&block_, 0, sizeof(block_));
+  return true;
+}
+
+void FlightRecorder::Record(uint32_t connection, const char* data,
+                            size_t length) {
+  if (file_ == nullptr) {
+    return;
+  }
+
+  FlightLogFormat::FrameHeader frame;
+  frame.steady_ns = NowNs(false);
+  frame.connection = connection;
+  frame.length = static_cast<uint32_t>(length);
+
+  if (block_.frame_count == 0) {
+    block_.first_frame = frame_count_;
+    block_.first_steady_ns = frame.steady_ns;
+  }
+  const char* bytes = reinterpret_cast<const char*>(&frame);
+  raw_.insert(raw_.end(), bytes, bytes + sizeof(frame));
+  raw_.insert(raw_.end(), data, data + length);
+  ++block_.frame_count;
+  ++frame_count_;
+
+  if (raw_.size() >= kBlockSize) {
+    FlushBlock();
+  }
+}
+
+void FlightRecorder::Flush() {
+  if (file_ == nullptr) {
+    return;
+  }
+  FlushBlock();
+}
+
+void FlightRecorder::FlushBlock() {
+  if (block_.frame_count == 0) {
+    return;
+  }
+
+  uLongf compressed_size = compressBound(raw_.size());
+  compressed_.resize(compressed_size);
+  compress2(compressed_.data(), &compressed_size,
+            reinterpret_cast<const Bytef*>(raw_.data()), raw_.size(),
+            Z_BEST_SPEED);
+
+  block_.magic = FlightLogFormat::kBlockMagic;
+  block_.raw_size = static_cast<uint32_t>(raw_.size());
+  block_.compressed_size = static_cast<uint32_t>(compressed_size);
+  block_.crc = crc32(0L, reinterpret_cast<const Bytef*>(raw_.data()),
+                     raw_.size());
+  fwrite(&block_, sizeof(block_), 1, file_);
+  fwrite(compressed_.data(), 1, compressed_size, file_);
+  // Push each block to the OS so a crash loses at most the one being filled
+  fflush(file_);
+
+  FlightLogFormat::IndexEntry entry;
+  memset(&entry, 0, sizeof(entry));
+  entry.offset = offset_;
+  entry.first_frame = block_.first_frame;
+  entry.first_steady_ns = block_.first_steady_ns;
+  entry.frame_count = block_.frame_count;
+  index_.push_back(entry);
+
+  offset_ += sizeof(block_) + compressed_size;
+  raw_.clear();
+  memset(&block_, 0, sizeof(block_));
+}
+
+void FlightRecorder::Close() {
+  if (file_ == nullptr) {
+    return;
+  }
+  FlushBlock();
+
+  FlightLogFormat::Footer footer;
+  memset(&footer, 0, sizeof(footer));
+  footer.index_offset = offset_;
+  footer.block_count = index_.size();
+  footer.frame_count = frame_count_;
+  memcpy(footer.magic, FlightLogFormat::kFooterMagic, sizeof(footer.magic));
+  if (!index_.empty()) {
+    fwrite(index_.data(), sizeof(index_[0]), index_.size(), file_);
+  }
+  fwrite(&footer, sizeof(footer), 1, file_);
+  fclose(file_);
+  file_ = nullptr;
+}
+
+//
+// FlightLog
+//
+FlightLog::FlightLog()
+    : fd_(-1),
+      map_(nullptr),
+      size_(0),
+      header_(nullptr),
+      blocks_end_(0),
+      frame_count_(0) {}
+
+FlightLog::~FlightLog() {
+  if (map_ != nullptr) {
+    munmap(const_cast<char*>(map_), size_);
+  }
+  if (fd_ >= 0) {
+    close(fd_);
+  }
+}
+
+bool FlightLog::Open(const std::string& path) {
+  fd_ = open(path.c_str(), O_RDONLY);
+  if (fd_ < 0) {
+    error_ = "cannot open " + path;
+    return false;
+  }
+  struct stat st;
+  if (fstat(fd_, &st) != 0 ||
+      static_cast<size_t>(st.st_size) < sizeof(FlightLogFormat::FileHeader)) {
+    error_ = path + " is not a flight log";
+    return false;
+  }
+  size_ = static_cast<size_t>(st.st_size);
+  void* map = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd_, 0);
+  if (map == MAP_FAILED) {
+    error_ = "cannot map " + path;
+    return false;
+  }
+  map_ = static_cast<const char*>(map);
+  madvise(map, size_, MADV_SEQUENTIAL);
+
+  header_ = reinterpret_cast<const FlightLogFormat::FileHeader*>(map_);
+  if (memcmp(header_->magic, FlightLogFormat::kFileMagic,
+             sizeof(header_->magic)) != 0 ||
+      header_->version != FlightLogFormat::kVersion) {
+    error_ = path + " is not a version " +
+             std::to_string(FlightLogFormat::kVersion) + " flight log";
+    return false;
+  }
+
+  // Use the index if the recorder was closed cleanly and every entry in it
+  // points at a whole block before the index
+  FlightLogFormat::Footer footer;
+  if (size_ >= sizeof(FlightLogFormat::FileHeader) + sizeof(footer)) {
+    memcpy(&footer, map_ + size_ - sizeof(footer), sizeof(footer));
+    const uint64_t max_blocks = (size_ - sizeof(footer)) /
+                                sizeof(FlightLogFormat::IndexEntry);
+    const uint64_t index_bytes =
+        footer.block_count * sizeof(FlightLogFormat::IndexEntry);
+    if (memcmp(footer.magic, FlightLogFormat::kFooterMagic,
+               sizeof(footer.magic)) == 0 &&
+        footer.block_count <= max_blocks &&
+        footer.index_offset >= sizeof(FlightLogFormat::FileHeader) &&
+        footer.index_offset + index_bytes + sizeof(footer) == size_) {
+      index_.resize(footer.block_count);
+      if (index_bytes > 0) {
+        memcpy(index_.data(), map_ + footer.index_offset, index_bytes);
+      }
+      blocks_end_ = footer.index_offset;
+      bool valid = true;
+      for (const FlightLogFormat::IndexEntry& entry : index_) {
+        valid = valid && BlockInBounds(entry.offset);
+      }
+      if (valid) {
+        frame_count_ = footer.frame_count;
+        return true;
+      }
+    }
+  }
+  return RebuildIndex();
+}
+
+bool FlightLog::BlockInBounds(uint64_t offset) const {
+  FlightLogFormat::BlockHeader block;
+  if (offset < sizeof(FlightLogFormat::FileHeader) || offset > blocks_end_ ||
+      blocks_end_ - offset < sizeof(block)) {
+    return false;
+  }
+  memcpy(&block, map_ + offset, sizeof(block));
+  return block.magic == FlightLogFormat::kBlockMagic &&
+         block.compressed_size <= blocks_end_ - offset - sizeof(block);
+}
+
+bool FlightLog::RebuildIndex() {
+  index_.clear();
+  frame_count_ = 0;
+  blocks_end_ = size_;
+  uint64_t offset = sizeof(FlightLogFormat::FileHeader);
+  FlightLogFormat::BlockHeader block;
+  while (BlockInBounds(offset)) {
+    // Anything else is the truncated tail of a log that was not closed
+    memcpy(&block, map_ + offset, sizeof(block));
+    FlightLogFormat::IndexEntry entry;
+    memset(&entry, 0, sizeof(entry));
+    entry.offset = offset;
+    entry.first_frame = block.first_frame;
+    entry.first_steady_ns = block.first_steady_ns;
+    entry.frame_count = block.frame_count;
+    index_.push_back(entry);
+    frame_count_ = block.first_frame + block.frame_count;
+    offset += sizeof(block) + block.compressed_size;
+  }
+  return true;
+}
+
+size_t FlightLog::FindBlockByFrame(uint64_t frame) const {
+  if (frame >= frame_count_) {
+    return index_.size();
+  }
+  auto it = std::upper_bound(
+      index_.begin(), index_.end(), frame,
+      [](uint64_t f, const FlightLogFormat::IndexEntry& e) {
+        return f < e.first_frame;
+      });
+  return static_cast<size_t>(it - index_.begin()) - 1;
+}
+
+size_t FlightLog::FindBlockByTime(int64_t steady_ns) const {
+  if (index_.empty()) {
+    return 0;
+  }
+  // The last block that starts at or before `steady_ns` holds the first
+  // frame at or after it, unless every frame there is older.
+  auto it = std::upper_bound(
+      index_.begin(), index_.end(), steady_ns,
+      [](int64_t t, const FlightLogFormat::IndexEntry& e) {
+        return t < e.first_steady_ns;
+      });
+  return it == index_.begin() ? 0 : static_cast<size_t>(it - index_.begin()) - 1;
+}
+
+bool FlightLog::ReadBlock(size_t i, std::vector<LoggedFrame>* frames) {
+  frames->clear();
+  if (i >= index_.size()) {
+    error_ = "block out of range";
+    return false;
+  }
+  if (!BlockInBounds(index_[i].offset)) {
+    error_ = "block " + std::to_string(i) + " lies outside the log";
+    return false;
+  }
+  FlightLogFormat::BlockHeader block;
+  memcpy(&block, map_ + index_[i].offset, sizeof(block));
+
+  raw_.resize(block.raw_size);
+  uLongf raw_size = block.raw_size;
+  const Bytef* compressed =
+      reinterpret_cast<const Bytef*>(map_ + index_[i].offset + sizeof(block));
+  if (uncompress(reinterpret_cast<Bytef*>(raw_.data()), &raw_size,
+                 compressed, block.compressed_size) != Z_OK ||
+      raw_size != block.raw_size ||
+      crc32(0L, reinterpret_cast<const Bytef*>(raw_.data()), raw_size) !=
+          block.crc) {
+    error_ = "corrupt block " + std::to_string(i);
+    return false;
+  }
+
+  size_t offset = 0;
+  FlightLogFormat::FrameHeader header;
+  while (offset + sizeof(header) <= raw_.size()) {
+    memcpy(&header, raw_.data() + offset, sizeof(header));
+    offset += sizeof(header);
+    if (offset + header.length > raw_.size()) {
+      error_ = "corrupt frame in block " + std::to_string(i);
+      return false;
+    }
+    LoggedFrame frame;
+    frame.steady_ns = header.steady_ns;
+    frame.connection = header.connection;
+    frame.data = raw_.data() + offset;
+    frame.length = header.length;
+    frames->push_back(frame);
+    offset += header.length;
+  }
+  return true;
+}
@@ -0,0 +1,165 @@
+#ifndef FLIGHT_RECORDER_H
+#define FLIGHT_RECORDER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+// Telemetry flight logs.
+//
+// A log is an append-only file of zlib-compressed blocks of frames, followed
+// by a seek index written when the recorder is closed:
+//
+//   FileHeader
+//   { BlockHeader, deflate(FrameHeader + payload, ...) } * block_count
+//   IndexEntry * block_count
+//   Footer
+//
+// Each frame carries the steady-clock time it was received and the id of the
+// connection it came from. A log whose recorder never closed (crash, kill)
+// has no index; FlightLog then rebuilds it by walking the block headers and
+// only the block that was still being filled is lost. The server flushes a
+// block every second even if it isn't full, which bounds that loss in time
+// too. All integers are little endian.
+
+struct FlightLogFormat {
+  static const char kFileMagic[8];
+  static const char kFooterMagic[8];
+  static const uint32_t kBlockMagic = 0x314b4c42;  // "BLK1"
+  static const uint32_t kVersion = 1;
+
+  struct FileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved;
+    // Wall clock and steady clock at the time the log was opened
+    int64_t start_wall_ns;
+    int64_t start_steady_ns;
+  };
+
+  struct BlockHeader {
+    uint32_t magic;
+    uint32_t frame_count;
+    uint64_t first_frame;
+    int64_t first_steady_ns;
+    uint32_t raw_size;
+    uint32_t compressed_size;
+    // crc32 of the uncompressed block
+    uint32_t crc;
+    uint32_t reserved;
+  };
+
+  struct FrameHeader {
+    int64_t steady_ns;
+    uint32_t connection;
+    uint32_t length;
+  };
+
+  struct IndexEntry {
+    uint64_t offset;
+    uint64_t first_frame;
+    int64_t first_steady_ns;
+    uint32_t frame_count;
+    uint32_t reserved;
+  };
+
+  struct Footer {
+    uint64_t index_offset;
+    uint64_t block_count;
+    uint64_t frame_count;
+    char magic[8];
+  };
+};
+
+// Appends frames to a log. Not thread safe; the server keeps one recorder
+// per shard.
+class FlightRecorder {
+ public:
+  FlightRecorder();
+  ~FlightRecorder();
+
+  // Create or truncate `path`. Returns false if it cannot be opened.
+  bool Open(const std::string& path);
+  bool is_open() const { return file_ != nullptr; }
+
+  // Record one frame, timestamped now. Compresses and writes a block once
+  // enough frames are buffered.
+  void Record(uint32_t connection, const char* data, size_t length);
+
+  // Compress and write the buffered frames now, as a block of their own.
+  void Flush();
+
+  // Write out the buffered block, the index and the footer.
+  void Close();
+
+ private:
+  // Uncompressed bytes buffered before a block is written
+  static const size_t kBlockSize = 64 * 1024;
+
+  void FlushBlock();
+
+  FILE* file_;
+  uint64_t offset_;
+  uint64_t frame_count_;
+  std::vector<char> raw_;
+  std::vector<unsigned char> compressed_;
+  FlightLogFormat::BlockHeader block_;
+  std::vector<FlightLogFormat::IndexEntry> index_;
+};
+
+// One recorded frame. `data` points into the block buffer of the FlightLog
+// that produced it and is valid until the next block is read.
+struct LoggedFrame {
+  int64_t steady_ns;
+  uint32_t connection;
+  const char* data;
+  size_t length;
+};
+
+// Read-only view of a log, memory-mapped.
+class FlightLog {
+ public:
+  FlightLog();
+  ~FlightLog();
+
+  // Map `path` and load (or rebuild) its index. On failure returns false and
+  // error() says why.
+  bool Open(const std::string& path);
+  const std::string& error() const { return error_; }
+
+  size_t block_count() const { return index_.size(); }
+  uint64_t frame_count() const { return frame_count_; }
+  const FlightLogFormat::FileHeader& header() const { return *header_; }
+  const FlightLogFormat::IndexEntry& block(size_t i) const {
+    return index_[i];
+  }
+
+  // Index of the block holding `frame` (block_count() if there is no such
+  // frame), or of the block holding the first frame at or after `steady_ns`.
+  size_t FindBlockByFrame(uint64_t frame) const;
+  size_t FindBlockByTime(int64_t steady_ns) const;
+
+  // Decompress block `i` and append its frames to `frames` (cleared first).
+  bool ReadBlock(size_t i, std::vector<LoggedFrame>* frames);
+
+ private:
+  bool RebuildIndex();
+  // Whether a block header with a valid magic starts at `offset` and the
+  // block ends by blocks_end_
+  bool BlockInBounds(uint64_t offset) const;
+
+  int fd_;
+  const char* map_;
+  size_t size_;
+  const FlightLogFormat::FileHeader* header_;
+  // Where the blocks end: at the index of a closed log, else the file's end
+  uint64_t blocks_end_;
+  uint64_t frame_count_;
+  std::vector<FlightLogFormat::IndexEntry> index_;
+  std::vector<char> raw_;
+  std::string error_;
+};
+
+#endif /* FLIGHT_RECORDER_H */
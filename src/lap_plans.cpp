@@ -0,0 +1,68 @@
+#include "lap_plans.h"
+#include <math.h>
+#include <algorithm>
+#include <cstdlib>
+#include <limits>
+
+constexpr double LapPlans::kSpacing;
+const int LapPlans::kReach;
+constexpr double LapPlans::kSpeedTolerance;
+constexpr double LapPlans::kSpeedPerSlot;
+
+LapPlans::LapPlans(double length)
+    : length_(length),
+      slots_(std::max(1, static_cast<int>(ceil(length / kSpacing)))),
+      size_(0),
+      speed_(slots_, std::numeric_limits<float>::quiet_NaN()) {}
+
+int LapPlans::SlotOf(double s) const {
+  double wrapped = fmod(s, length_);
+  if (wrapped < 0) {
+    wrapped += length_;
+  }
+  return std::min(static_cast<int>(wrapped / kSpacing), slots_ - 1);
+}
+
+void LapPlans::Store(double s, double v, const double* plan, size_t size) {
+  if (size_ == 0) {
+    size_ = size;
+    plans_.assign(slots_ * size_, 0.0f);
+  }
+  if (size != size_) {
+    return;
+  }
+  const int slot = SlotOf(s);
+  speed_[slot] = static_cast<float>(v);
+  std::copy(plan, plan + size, plans_.begin() + slot * size_);
+}
+
+bool LapPlans::Nearest(double s, double v, size_t size,
+                       std::vector<double>* plan) const {
+  if (size != size_ || size_ == 0) {
+    return false;
+  }
+  // Slots within reach either way, the closest in distance and speed
+  const int center = SlotOf(s);
+  int best = -1;
+  double best_score = std::numeric_limits<double>::max();
+  for (int d = -kReach; d <= kReach; ++d) {
+    const int slot = (center + d + slots_) % slots_;
+    const double dv = fabs(speed_[slot] - v);
+    // False for empty slots too: NaN compares false
+    if (!(dv <= kSpeedTolerance)) {
+      continue;
+    }
+    const double score = std::abs(d) + dv / kSpeedPerSlot;
+    if (score < best_score) {
+      best_score = score;
+      best = slot;
+    }
+  }
+  if (best < 0) {
+    return false;
+  }
+  const std::vector<float>::const_iterator first =
+      plans_.begin() + best * size_;
+  plan->assign(first, first + size_);
+  return true;
+}
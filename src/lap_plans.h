@@ -0,0 +1,54 @@
+#ifndef LAP_PLANS_H
+#define LAP_PLANS_H
+
+#include <cstddef>
+#include <vector>
+
+// Converged MPC plans by position on a closed track, for starting the solver
+// where no plan from the frame before is at hand: a new connection, a
+// simulator reset, a failed solve.
+//
+// The lap is cut into kSpacing meter slots, each holding the last plan
+// solved there and the speed it was solved at, as floats. A slot is
+// overwritten each lap, so the ring always holds the latest lap. On the
+// lake track at the MPC's 10 steps this is under 50 KB.
+//
+// Not thread safe; a shard's sessions share one on its solver thread.
+class LapPlans {
+ public:
+  // Slot length along the track, in meters
+  static constexpr double kSpacing = 2.0;
+  // How far from the car a stored plan is still used, in slots
+  static const int kReach = 2;
+  // Largest difference from the car's speed a stored plan is used at, and
+  // the speed difference counted as far as one slot of distance
+  static constexpr double kSpeedTolerance = 10.0;
+  static constexpr double kSpeedPerSlot = 5.0;
+
+  // A ring over a lap of `length` meters.
+  explicit LapPlans(double length);
+
+  // Store `plan`, `size` actuators as MPC::last_plan() lays them out,
+  // solved at arc length `s` and speed `v`.
+  void Store(double s, double v, const double* plan, size_t size);
+
+  // The stored plan of `size` actuators closest to arc length `s` and speed
+  // `v`, into `plan`. Returns false if none is within reach.
+  bool Nearest(double s, double v, size_t size,
+               std::vector<double>* plan) const;
+
+ private:
+  // Slot of arc length `s`, wrapped around the lap
+  int SlotOf(double s) const;
+
+  const double length_;
+  const int slots_;
+  // Actuators per plan; fixed by the first one stored
+  size_t size_;
+  // Speed each slot's plan was solved at; NaN while empty
+  std::vector<float> speed_;
+  // size_ actuators per slot
+  std::vector<float> plans_;
+};
+
+#endif /* LAP_PLANS_H */
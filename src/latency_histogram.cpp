@@ -0,0 +1,191 @@
+#include "latency_histogram.h"
+#include <iomanip>
+#include <mutex>
+#include "sample_stats.h"
+
+namespace {
+
+const char* const kStageNames[kStageCount] = {
+    "receive", "queue", "frame",     "parse",     "transform", "fit",
+    "predict", "solve", "serialize", "actuation", "send"};
+
+struct ThreadHistograms {
+  LatencyHistogram stages[kStageCount];
+};
+
+// Every thread's histograms. Deliberately leaked: threads may still record
+// while the process exits.
+std::mutex& RegistryMutex() {
+  static std::mutex* mutex = new std::mutex;
+  return *mutex;
+}
+
+std::vector<ThreadHistograms*>& Registry() {
+  static std::vector<ThreadHistograms*>* registry =
+      new std::vector<ThreadHistograms*>;
+  return *registry;
+}
+
+ThreadHistograms* LocalHistograms() {
+  thread_local ThreadHistograms* local = nullptr;
+  if (local == nullptr) {
+    local = new ThreadHistograms;
+    std::lock_guard<std::mutex> lock(RegistryMutex());
+    Registry().push_back(local);
+  }
+  return local;
+}
+
+// Single writer: a relaxed load and store is enough, and cheaper than a
+// fetch_add.
+void Add(std::atomic<uint64_t>* counter, uint64_t value) {
+  counter->store(counter->load(std::memory_order_relaxed) + value,
+                 std::memory_order_relaxed);
+}
+
+}  // namespace
+
+const char* StageName(Stage stage) { return kStageNames[stage]; }
+
+HistogramCounts::HistogramCounts()
+    : buckets(LatencyHistogram::kBucketCount), count(0), sum_ns(0),
+      max_ns(0) {}
+
+uint64_t HistogramCounts::Percentile(double q) const {
+  uint64_t total = 0;
+  for (uint64_t n : buckets) {
+    total += n;
+  }
+  if (total == 0) {
+    return 0;
+  }
+  const uint64_t rank = NearestRank(q, total);
+  uint64_t seen = 0;
+  for (size_t i = 0; i < buckets.size(); ++i) {
+    seen += buckets[i];
+    if (seen >= rank) {
+      uint64_t bound = LatencyHistogram::BucketUpperBound(i);
+      return bound < max_ns ? bound : max_ns;
+    }
+  }
+  return max_ns;
+}
+
+uint64_t HistogramCounts::CountAtOrBelow(uint64_t ns) const {
+  uint64_t total = 0;
+  for (size_t i = 0; i < buckets.size(); ++i) {
+    if (LatencyHistogram::BucketUpperBound(i) > ns) {
+      break;
+    }
+    total += buckets[i];
+  }
+  return total;
+}
+
+LatencyHistogram::LatencyHistogram() {
+  for (std::atomic<uint64_t>& bucket : buckets_) {
+    bucket.store(0, std::memory_order_relaxed);
+  }
+  count_.store(0, std::memory_order_relaxed);
+  sum_ns_.store(0, std::memory_order_relaxed);
+  max_ns_.store(0, std::memory_order_relaxed);
+}
+
+void LatencyHistogram::Record(uint64_t ns) {
+  Add(&buckets_[BucketIndex(ns)], 1);
+  Add(&count_, 1);
+  Add(&sum_ns_, ns);
+  if (ns > max_ns_.load(std::memory_order_relaxed)) {
+    max_ns_.store(ns, std::memory_order_relaxed);
+  }
+}
+
+void LatencyHistogram::AddTo(HistogramCounts* totals) const {
+  for (size_t i = 0; i < kBucketCount; ++i) {
+    totals->buckets[i] += buckets_[i].load(std::memory_order_relaxed);
+  }
+  totals->count += count_.load(std::memory_order_relaxed);
+  totals->sum_ns += sum_ns_.load(std::memory_order_relaxed);
+  uint64_t max_ns = max_ns_.load(std::memory_order_relaxed);
+  if (max_ns > totals->max_ns) {
+    totals->max_ns = max_ns;
+  }
+}
+
+size_t LatencyHistogram::BucketIndex(uint64_t ns) {
+  const uint64_t sub_buckets = uint64_t(1) << kSubBucketBits;
+  if (ns < sub_buckets) {
+    return static_cast<size_t>(ns);
+  }
+  int exponent = 63 - __builtin_clzll(ns);
+  if (exponent > kMaxExponent) {
+    return kBucketCount - 1;
+  }
+  // Block `exponent - kSubBucketBits + 1` holds [2^exponent, 2^(exponent+1))
+  // in sub_buckets steps
+  const int shift = exponent - kSubBucketBits;
+  return (static_cast<size_t>(shift + 1) << kSubBucketBits) +
+         static_cast<size_t>((ns >> shift) - sub_buckets);
+}
+
+uint64_t LatencyHistogram::BucketUpperBound(size_t index) {
+  const uint64_t sub_buckets = uint64_t(1) << kSubBucketBits;
+  if (index < sub_buckets) {
+    return index;
+  }
+  const int shift = static_cast<int>(index >> kSubBucketBits) - 1;
+  const uint64_t sub = index & (sub_buckets - 1);
+  return ((sub_buckets + sub + 1) << shift) - 1;
+}
+
+void RecordStage(Stage stage, uint64_t ns) {
+  LocalHistograms()->stages[stage].Record(ns);
+}
+
+void RecordStageSeconds(Stage stage, double seconds) {
+  RecordStage(stage, seconds > 0 ? static_cast<uint64_t>(seconds * 1e9) : 0);
+}
+
+void RecordStageSpan(Stage stage, std::chrono::steady_clock::time_point start,
+                     std::chrono::steady_clock::time_point end) {
+  RecordStage(stage, std::chrono::duration_cast<std::chrono::nanoseconds>(
+                         end - start)
+                         .count());
+  TraceSpan(StageName(stage), start, end);
+}
+
+HistogramCounts AggregateStage(Stage stage) {
+  HistogramCounts totals;
+  std::lock_guard<std::mutex> lock(RegistryMutex());
+  for (const ThreadHistograms* thread : Registry()) {
+    thread->stages[stage].AddTo(&totals);
+  }
+  return totals;
+}
+
+void PrintStageReport(std::ostream& out) {
+  const double us = 1e-3;
+  out << std::left << std::setw(10) << "stage" << std::right << std::setw(10)
+      << "count" << std::setw(12) << "mean us" << std::setw(12) << "p50 us"
+      << std::setw(12) << "p90 us" << std::setw(12) << "p99 us"
+      << std::setw(12) << "p99.9 us" << std::setw(12) << "max us"
+      << std::endl;
+  std::ios::fmtflags flags = out.flags();
+  std::streamsize precision = out.precision();
+  for (int i = 0; i < kStageCount; ++i) {
+    Stage stage = static_cast<Stage>(i);
+    HistogramCounts h = AggregateStage(stage);
+    if (h.count == 0) {
+      continue;
+    }
+    out << std::left << std::setw(10) << StageName(stage) << std::right
+        << std::setw(10) << h.count << std::fixed << std::setprecision(1)
+        << std::setw(12) << static_cast<double>(h.sum_ns) / h.count * us
+        << std::setw(12) << h.Percentile(0.5) * us << std::setw(12)
+        << h.Percentile(0.9) * us << std::setw(12) << h.Percentile(0.99) * us
+        << std::setw(12) << h.Percentile(0.999) * us << std::setw(12)
+        << h.max_ns * us << std::endl;
+  }
+  out.flags(flags);
+  out.precision(precision);
+}
@@ -0,0 +1,115 @@
+#ifndef LATENCY_HISTOGRAM_H
+#define LATENCY_HISTOGRAM_H
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <vector>
+#include "trace.h"
+
+// Per-stage latency histograms for the message path.
+//
+// Every thread records into its own set of histograms, so recording takes no
+// locks and no atomic read-modify-writes. Readers merge all threads' sets on
+// demand; a thread's histograms outlive it so nothing recorded is lost.
+
+// Stages of one message, in the order it passes through them.
+enum Stage {
+  kStageReceive,    // uWS onMessage handler on the hub thread
+  kStageQueue,      // waiting for the shard's solver thread
+  kStageFrame,      // extracting the JSON from the Socket.IO frame
+  kStageParse,      // json::parse and reading the telemetry fields
+  kStageTransform,  // waypoints to the car's coordinate system
+  kStageFit,        // polyfit
+  kStagePredict,    // cte, epsi and the state after the actuator latency
+  kStageSolve,      // MPC::Solve
+  kStageSerialize,  // display points and the steer reply
+  kStageActuation,  // simulated actuator latency before the reply goes out
+  kStageSend,       // ws.send
+  kStageCount
+};
+
+const char* StageName(Stage stage);
+
+// Merged contents of one or more histograms.
+struct HistogramCounts {
+  HistogramCounts();
+
+  // Duration at quantile `q` in [0, 1], in nanoseconds: the upper bound of
+  // the bucket holding it, capped at the largest recorded value.
+  uint64_t Percentile(double q) const;
+
+  // Number of recorded values in buckets wholly at or below `ns`.
+  uint64_t CountAtOrBelow(uint64_t ns) const;
+
+  std::vector<uint64_t> buckets;
+  uint64_t count;
+  uint64_t sum_ns;
+  uint64_t max_ns;
+};
+
+// Log-linear histogram of durations in nanoseconds, HDR style. Values below
+// 2^kSubBucketBits get a bucket each; above that every power of two is split
+// into 2^kSubBucketBits linear buckets, so a recorded value is known to
+// within about 3%. Values above 2^(kMaxExponent + 1) ns (two minutes) land in
+// the top bucket.
+//
+// One thread records, any thread may read.
+class LatencyHistogram {
+ public:
+  static const int kSubBucketBits = 5;
+  static const int kMaxExponent = 36;
+  static const size_t kBucketCount =
+      static_cast<size_t>(kMaxExponent - kSubBucketBits + 2) << kSubBucketBits;
+
+  LatencyHistogram();
+
+  void Record(uint64_t ns);
+
+  // Add the current counts to `totals`.
+  void AddTo(HistogramCounts* totals) const;
+
+  static size_t BucketIndex(uint64_t ns);
+  // Largest value that maps to bucket `index`.
+  static uint64_t BucketUpperBound(size_t index);
+
+ private:
+  std::atomic<uint64_t> buckets_[kBucketCount];
+  std::atomic<uint64_t> count_;
+  std::atomic<uint64_t> sum_ns_;
+  std::atomic<uint64_t> max_ns_;
+};
+
+// Record `ns` (or `seconds`) for `stage` in the calling thread's histograms.
+void RecordStage(Stage stage, uint64_t ns);
+void RecordStageSeconds(Stage stage, double seconds);
+
+// Record the time from `start` to `end` for `stage` and, when tracing, a
+// span named after the stage.
+void RecordStageSpan(Stage stage, std::chrono::steady_clock::time_point start,
+                     std::chrono::steady_clock::time_point end);
+
+// Merge every thread's histogram of `stage`.
+HistogramCounts AggregateStage(Stage stage);
+
+// Count, percentiles and max of every stage that has samples, in
+// microseconds, one line per stage.
+void PrintStageReport(std::ostream& out);
+
+// Records the time from construction to destruction for a stage.
+class StageTimer {
+ public:
+  explicit StageTimer(Stage stage)
+      : stage_(stage), start_(std::chrono::steady_clock::now()) {}
+  ~StageTimer() {
+    RecordStageSpan(stage_, start_, std::chrono::steady_clock::now());
+  }
+
+ private:
+  const Stage stage_;
+  const std::chrono::steady_clock::time_point start_;
+};
+
+#endif /* LATENCY_HISTOGRAM_H */
@@ -0,0 +1,80 @@
+#include "live_weights.h"
+#include <fstream>
+#include "json.hpp"
+
+using json = nlohmann::json;
+
+namespace {
+
+struct Field {
+  const char* name;
+  double MPCWeights::*member;
+};
+const Field kFields[] = {{"ref_cte", &MPCWeights::ref_cte},
+                         {"ref_epsi", &MPCWeights::ref_epsi},
+                         {"ref_v", &MPCWeights::ref_v},
+                         {"cte_w", &MPCWeights::cte_w},
+                         {"epsi_w", &MPCWeights::epsi_w},
+                         {"v_w", &MPCWeights::v_w},
+                         {"actuator_w", &MPCWeights::actuator_w},
+                         {"change_steer_w", &MPCWeights::change_steer_w},
+                         {"change_accel_w", &MPCWeights::change_accel_w}};
+
+}  // namespace
+
+bool LoadWeights(const std::string& path, MPCWeights* weights,
+                 std::string* error) {
+  std::ifstream in(path);
+  if (!in) {
+    *error = "cannot open " + path;
+    return false;
+  }
+  json j;
+  try {
+    in >> j;
+  } catch (const std::exception& e) {
+    *error = path + ": " + e.what();
+    return false;
+  }
+  if (!j.is_object()) {
+    *error = path + ": expected an object";
+    return false;
+  }
+
+  MPCWeights loaded = *weights;
+  for (auto it = j.begin(); it != j.end(); ++it) {
+    const Field* field = nullptr;
+    for (const Field& f : kFields) {
+      if (it.key() == f.name) {
+        field = &f;
+      }
+    }
+    if (field == nullptr) {
+      *error = path + ": unknown weight " + it.key();
+      return false;
+    }
+    if (!it.value().is_number()) {
+      *error = path + ": " + it.key() + " must be a number";
+      return false;
+    }
+    loaded.*field->member = it.value().get<double>();
+  }
+  const std::string invalid = CheckWeights(loaded);
+  if (!invalid.empty()) {
+    *error = path + ": " + invalid;
+    return false;
+  }
+  *weights = loaded;
+  return true;
+}
+
+LiveWeights::LiveWeights(const MPCWeights& weights)
+    : weights_(std::make_shared<const MPCWeights>(weights)) {}
+
+std::shared_ptr<const MPCWeights> LiveWeights::Get() const {
+  return std::atomic_load(&weights_);
+}
+
+void LiveWeights::Set(const MPCWeights& weights) {
+  std::atomic_store(&weights_, std::make_shared<const MPCWeights>(weights));
+}
@@ -0,0 +1,31 @@
+#ifndef LIVE_WEIGHTS_H
+#define LIVE_WEIGHTS_H
+
+#include <memory>
+#include <string>
+#include "mpc_config.h"
+
+// Reads the cost references and weights in `path`, a JSON object keyed by
+// MPCWeights' member names, e.g. {"cte_w": 1200, "ref_v": 110}. Names left
+// out keep their value in `weights`, which is only changed if the whole
+// file is valid. Returns false with the reason in `error` otherwise.
+bool LoadWeights(const std::string& path, MPCWeights* weights,
+                 std::string* error);
+
+// Cost weights every session solves with, replaced whole while they run.
+//
+// Sessions take the current weights once per frame, so a new set applies
+// from the next cycle on and never to half of one. Get() and Set() are
+// safe from any thread.
+class LiveWeights {
+ public:
+  explicit LiveWeights(const MPCWeights& weights);
+
+  std::shared_ptr<const MPCWeights> Get() const;
+  void Set(const MPCWeights& weights);
+
+ private:
+  std::shared_ptr<const MPCWeights> weights_;
+};
+
+#endif /* LIVE_WEIGHTS_H */
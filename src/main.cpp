@@ -1,266 +1,140 @@
-#include <math.h>
-#include <uWS/uWS.h>
+#include <signal.h>
+#include <unistd.h>
 #include <chrono>
+#include <cstdlib>
+#include <fstream>
 #include <iostream>
+#include <memory>
+#include <string>
 #include <thread>
 #include <vector>
-#include "Eigen-3.3/Eigen/Core"
-#include "Eigen-3.3/Eigen/QR"
 #include "MPC.h"
-#include "json.hpp"
-
-// for convenience
-using json = nlohmann::json;
-
-// For converting back and forth between radians and degrees.
-constexpr double pi() { return M_PI; }
-double deg2rad(double x) { return x * pi() / 180; }
-double rad2deg(double x) { return x * 180 / pi(); }
-
-// Checks if the SocketIO event has JSON data.
-// If there is data the JSON object in string format will be returned,
-// else the empty string "" will be returned.
-string hasData(string s) {
-  auto found_null = s.find("null");
-  auto b1 = s.find_first_of("[");
-  auto b2 = s.rfind("}]");
-  if (found_null != string::npos) {
-    return "";
-  } else if (b1 != string::npos && b2 != string::npos) {
-    return s.substr(b1, b2 - b1 + 2);
-  }
-  return "";
-}
-
-// Evaluate a polynomial.
-double polyeval(Eigen::VectorXd coeffs, double x) {
-  double result = 0.0;
-  for (int i = 0; i < coeffs.size(); i++) {
-    result += coeffs[i] * pow(x, i);
+#include "alloc_profile.h"
+#include "latency_histogram.h"
+#include "live_weights.h"
+#include "profiler.h"
+#include "server_options.h"
+#include "shard.h"
+#include "spline_track.h"
+#include "trace.h"
+#include "track_file.h"
+#include "weights_watcher.h"
+
+int main(int argc, char *argv[]) {
+  ServerOptions options;
+  if (!ParseServerOptions(argc, argv, &options)) {
+    return -1;
   }
-  return result;
-}
 
-// Fit a polynomial.
-// Adapted from
-// https://github.com/JuliaMath/Polynomials.jl/blob/master/src/Polynomials.jl#L676-L716
-Eigen::VectorXd polyfit(Eigen::VectorXd xvals, Eigen::VectorXd yvals,
-                        int order) {
-  assert(xvals.size() == yvals.size());
-  assert(order >= 1 && order <= xvals.size() - 1);
-  Eigen::MatrixXd A(xvals.size(), order + 1);
+  // Every shard has its own solver thread; CppAD has to know about them
+  // before any of them records a tape.
+  MPC::SetupThreads(options.threads, options.linear_solver);
 
-  for (int i = 0; i < xvals.size(); i++) {
-    A(i, 0) = 1.0;
+  std::string error;
+  if (!options.no_heap_stages.empty() &&
+      !SetNoHeapStages(options.no_heap_stages, &error)) {
+    std::cerr << error << std::endl;
+    return -1;
   }
 
-  for (int j = 0; j < xvals.size(); j++) {
-    for (int i = 0; i < order; i++) {
-      A(j, i + 1) = A(j, i) * xvals(j);
+  // Mapped (or loaded and fitted) once, then shared read-only by every
+  // session
+  TrackFile track_file;
+  const SplineTrack* track_map = nullptr;
+  if (!options.track_path.empty()) {
+    if (!track_file.Open(options.track_path)) {
+      std::cerr << "Failed to load track: " << track_file.error() << std::endl;
+      return -1;
     }
+    track_map = &track_file.track();
   }
 
-  auto Q = A.householderQr();
-  auto result = Q.solve(yvals);
-  return result;
-}
-
-int main() {
-  uWS::Hub h;
-
-  // MPC is initialized here!
-  MPC mpc;
-
-  h.onMessage([&mpc](uWS::WebSocket<uWS::SERVER> ws, char *data, size_t length,
-                     uWS::OpCode opCode) {
-    // "42" at the start of the message means there's a websocket message event.
-    // The 4 signifies a websocket message
-    // The 2 signifies a websocket event
-    string sdata = string(data).substr(0, length);
-    cout << sdata << endl;
-    if (sdata.size() > 2 && sdata[0] == '4' && sdata[1] == '2') {
-      string s = hasData(sdata);
-      if (s != "") {
-        auto j = json::parse(s);
-        string event = j[0].get<string>();
-        if (event == "telemetry") {
-          // j[1] is the data JSON object
-          vector<double> ptsx = j[1]["ptsx"];  // waypoints-x
-          vector<double> ptsy = j[1]["ptsy"];  // waypoints-y
-          double px = j[1]["x"];  // car x-position
-          double py = j[1]["y"];  // car y-position
-          double psi = j[1]["psi"];  // car psi (heading)
-          double v = j[1]["speed"];  // car velocity
-          double delta = j[1]["steering_angle"];  // ''
-          double a = j[1]["throttle"];  // acceleration
-
-          /*
-          * TODO: Calculate steering angle and throttle using MPC.
-          *
-          * Both are in between [-1, 1].
-          *
-          */
-          // Transform pts (waypoints) to the car's coordinate system
-          for (size_t i = 0; i < ptsx.size(); ++i)
-          {
-            // Shift car reference angle to 90 degrees
-            double dx = ptsx[i] - px;
-            double dy = ptsy[i] - py;
-            ptsx[i] = dx * cos(-psi) - dy * sin(-psi);
-            ptsy[i] = dx * sin(-psi) + dy * cos(-psi);
-          }
-
-          // Pointers to waypoints
-          double* ptrx = &ptsx[0];
-          double* ptry = &ptsy[0];
-
-          // Convert to Eigen::VectorXd (using 6 waypoints)
-          Eigen::Map<Eigen::VectorXd> ptsx_transform(ptrx, 6);
-          Eigen::Map<Eigen::VectorXd> ptsy_transform(ptry, 6);
-
-          // Fit coefficients (coeffs) of third order polynomial
-          auto coeffs = polyfit(ptsx_transform, ptsy_transform, 3);
-
-          // Calculate cross track error: distance between car and polynomial guideline created from waypoints
-          // polyeval evaluates y values of given x coordinates
-          double cte = polyeval(coeffs, 0);
-
-          // Error in car's orientation measured against the tangent of the guideline created from waypoints
-          // double epsi = psi - atan(coeffs[1] + 2 * px * coeffs[2] + 3 * coeffs[3] * pow(px, 2));
-          // after zeroing out much of the above formula we have:
-          double epsi = -atan(coeffs[1]);
-
-          // Latency for predicting time at actuation; in a real car there will be a delay in execution
-          const double delay_t = 0.1;  // delay in actuator execution in seconds
-          // See MPC.cpp for explanation
-          const double Lf = 2.67;
-
-          // Predict future state with latency taken into account
-          double delay_x = 0.0 + v * delay_t;  // psi is zero; omit
-          const double delay_y = 0.0;  // y remains zero
-          double delay_psi = 0.0 + v * -delta / Lf * delay_t;
-          double delay_v = v + a * delay_t;
-          double delay_cte = cte + v * sin(epsi) * delay_t;
-          double delay_epsi = epsi + v * -delta / Lf * delay_t;
-
-          // A state vector that includes cte and epsi will capture how these errors change over time
-          // Feed in the state values
-          Eigen::VectorXd state(6);
-//        state << 0, 0, 0, v, cte, epsi;  // delay not factored in (car doesn't last long on track)
-          // New state values that take latency into account
-          state << delay_x, delay_y, delay_psi, delay_v, delay_cte, delay_epsi;
-
-
-          // Ipopt is the tool used to optimize control inputs; it expects vectors for variables and constraints
-
-          // vars vector contains all variables used by the cost function and model
-          // [x,y,psi,v,cte,epsi] and [delta,a]
-          auto vars = mpc.Solve(state, coeffs);
-
-          // Yellow line in simulator (the line to follow)
-          // Line formed by polyfitting the waypoints
-          // Prediction horizon is the duration of future predictions (based on product of N and dt)
-          // N = 10; dt = 0.1
-          vector<double> next_x_vals;
-          vector<double> next_y_vals;
-
-          double poly_inc = 2.5;  // x-value increment
-          int num_points = 25; // number of future points to be plotted
-
-          for (int i = 1; i < num_points; ++i) {
-            next_x_vals.push_back(poly_inc * i);
-            next_y_vals.push_back(polyeval(coeffs, poly_inc * i));
-          }
-
-          // Normalize steering angle range: [-deg2rad(25), deg2rad(25)] -> [-1, 1]
-          const double angle_norm_denom = deg2rad(25) * Lf;
-          double steer_value = vars[0] / angle_norm_denom;
-          double throttle_value = vars[1];
-
-          // Display the MPC predicted trajectory (green line in simulator); vehicle's predicted path
-          vector<double> mpc_x_vals;
-          vector<double> mpc_y_vals;
-
-          for (size_t i = 2; i < vars.size(); ++i) {
-            // every even will be an x; every odd will be a y
-            if (i % 2 == 0) {
-              mpc_x_vals.push_back(vars[i]);
-            }
-            else {
-              mpc_y_vals.push_back(vars[i]);
-            }
-          }
-
-          // plug data into simulator
-          json msgJson;
-          // NOTE: Remember to divide by deg2rad(25) before you send the steering value back.
-          // Otherwise the values will be in between [-deg2rad(25), deg2rad(25] instead of [-1, 1].
-          msgJson["steering_angle"] = steer_value;
-          msgJson["throttle"] = throttle_value;
-
-          //.. add (x,y) points to list here, points are in reference to the vehicle's coordinate system
-          // the points in the simulator are connected by a Yellow line
-          msgJson["next_x"] = next_x_vals;
-          msgJson["next_y"] = next_y_vals;
+  // Loaded before the shards start, so no session solves with other
+  // weights than the file's
+  const MPCWeights base = MPCParams().weights;
+  std::unique_ptr<LiveWeights> weights;
+  if (!options.weights_path.empty()) {
+    MPCWeights loaded = base;
+    if (!LoadWeights(options.weights_path, &loaded, &error)) {
+      std::cerr << "Failed to load weights: " << error << std::endl;
+      return -1;
+    }
+    weights.reset(new LiveWeights(loaded));
+  }
 
-          //.. add (x,y) points to list here, points are in reference to the vehicle's coordinate system
-          // the points in the simulator are connected by a Green line
-          msgJson["mpc_x"] = mpc_x_vals;
-          msgJson["mpc_y"] = mpc_y_vals;
+  if (!options.trace_path.empty() && !StartTracing(options.trace_path)) {
+    std::cerr << "Failed to open " << options.trace_path << std::endl;
+    return -1;
+  }
 
+  // Signals are handled by the main thread alone: block them before the
+  // shards start so every thread inherits the mask.
+  sigset_t signals;
+  sigemptyset(&signals);
+  sigaddset(&signals, SIGINT);
+  sigaddset(&signals, SIGTERM);
+  sigaddset(&signals, SIGUSR1);
+  sigaddset(&signals, SIGUSR2);
+  pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+
+  WeightsWatcher watcher;
+  if (weights != nullptr &&
+      !watcher.Start(options.weights_path, base, weights.get(), &error)) {
+    std::cerr << "Failed to watch weights: " << error << std::endl;
+    return -1;
+  }
 
-          auto msg = "42[\"steer\"," + msgJson.dump() + "]";
-          std::cout << msg << std::endl;
-          // Latency
-          // The purpose is to mimic real driving conditions where
-          // the car does actuate the commands instantly.
-          //
-          // Feel free to play around with this value but should be to drive
-          // around the track with 100ms latency.
-          //
-          // NOTE: REMEMBER TO SET THIS TO 100 MILLISECONDS BEFORE
-          // SUBMITTING.
-          this_thread::sleep_for(chrono::milliseconds(100));
-          ws.send(msg.data(), msg.length(), uWS::OpCode::TEXT);
+  // Each connection gets its own MPC inside a Session; shards only share
+  // the listening port.
+  std::vector<std::thread> threads;
+  for (size_t i = 0; i < options.threads; ++i) {
+    const LiveWeights* live = weights.get();
+    threads.emplace_back([&options, i, track_map, live]() {
+      Shard shard(options, i, track_map, live);
+      if (!shard.Run()) {
+        std::cerr << "Failed to start shard " << i << std::endl;
+        exit(-1);
+      }
+    });
+  }
+  std::cout << "Listening to port " << options.port << " with "
+            << options.threads << " threads" << std::endl;
+
+  // SIGUSR1 prints the per-stage latency percentiles (and, when profiling,
+  // allocations) so far; SIGINT and SIGTERM print them and exit. SIGUSR2
+  // starts the sampling profiler, or stops it and writes the profile.
+  while (true) {
+    int signal = 0;
+    if (sigwait(&signals, &signal) != 0) {
+      continue;
+    }
+    if (signal == SIGUSR2) {
+      if (!ProfilerRunning()) {
+        if (StartProfiler(&error)) {
+          std::cout << "Profiling" << std::endl;
+        } else {
+          std::cerr << error << std::endl;
         }
+        continue;
+      }
+      std::ofstream out(options.profile_path);
+      out << StopProfiler();
+      if (out.good()) {
+        std::cout << "Wrote " << options.profile_path << std::endl;
       } else {
-        // Manual driving
-        std::string msg = "42[\"manual\",{}]";
-        ws.send(msg.data(), msg.length(), uWS::OpCode::TEXT);
+        std::cerr << "Failed to write " << options.profile_path << std::endl;
       }
+      continue;
     }
-  });
-
-  // We don't need this since we're not using HTTP but if it's removed the
-  // program
-  // doesn't compile :-(
-  h.onHttpRequest([](uWS::HttpResponse *res, uWS::HttpRequest req, char *data,
-                     size_t, size_t) {
-    const std::string s = "<h1>Hello world!</h1>";
-    if (req.getUrl().valueLength == 1) {
-      res->end(s.data(), s.length());
-    } else {
-      // i guess this should be done more gracefully?
-      res->end(nullptr, 0);
+    PrintStageReport(std::cout);
+    PrintAllocReport(std::cout);
+    if (signal != SIGUSR1) {
+      Shard::CloseRecorders(std::chrono::seconds(2));
+      StopTracing();
+      std::cout.flush();
+      // The shards never return from their loops; don't run destructors
+      // under them
+      _exit(0);
     }
-  });
-
-  h.onConnection([&h](uWS::WebSocket<uWS::SERVER> ws, uWS::HttpRequest req) {
-    std::cout << "Connected!!!" << std::endl;
-  });
-
-  h.onDisconnection([&h](uWS::WebSocket<uWS::SERVER> ws, int code,
-                         char *message, size_t length) {
-    ws.close();
-    std::cout << "Disconnected" << std::endl;
-  });
-
-  int port = 4567;
-  if (h.listen(port)) {
-    std::cout << "Listening to port " << port << std::endl;
-  } else {
-    std::cerr << "Failed to listen to port" << std::endl;
-    return -1;
   }
-  h.run();
 }
@@ -0,0 +1,197 @@
+#include "metrics.h"
+#include <atomic>
+#include <cstdint>
+#include <sstream>
+#include "latency_histogram.h"
+
+namespace {
+
+std::atomic<uint64_t> frames_received(0);
+std::atomic<uint64_t> frames_coalesced(0);
+std::atomic<uint64_t> frames_dropped(0);
+std::atomic<uint64_t> replies_sent(0);
+std::atomic<int64_t> sessions_active(0);
+
+// Zero-initialized like any array with static storage
+std::atomic<uint64_t> solves_by_status[MPC::kStatusCount];
+
+// Upper bounds of the iteration histogram buckets; the last one is +Inf
+const int kIterationBounds[] = {2, 4, 6, 8, 10, 15, 20, 30, 50, 100, 200};
+const size_t kIterationBuckets =
+    sizeof(kIterationBounds) / sizeof(kIterationBounds[0]) + 1;
+std::atomic<uint64_t> iteration_buckets[kIterationBuckets];
+std::atomic<uint64_t> iteration_sum(0);
+
+std::atomic<uint64_t> weights_reloads(0);
+std::atomic<uint64_t> weights_rejected(0);
+// Of the last reload, in nanoseconds so they fit an atomic integer
+std::atomic<uint64_t> weights_reload_ns(0);
+std::atomic<uint64_t> weights_first_solve_ns(0);
+
+// Upper bounds of the exported stage latency buckets. The stage histograms
+// are finer; a bucket straddling a bound counts towards the next one.
+struct LatencyBound {
+  uint64_t ns;
+  const char* label;
+};
+const LatencyBound kLatencyBounds[] = {
+    {10000, "1e-05"},      {25000, "2.5e-05"},    {50000, "5e-05"},
+    {100000, "0.0001"},    {250000, "0.00025"},   {500000, "0.0005"},
+    {1000000, "0.001"},    {2500000, "0.0025"},   {5000000, "0.005"},
+    {10000000, "0.01"},    {25000000, "0.025"},   {50000000, "0.05"},
+    {100000000, "0.1"},    {250000000, "0.25"},   {500000000, "0.5"},
+    {1000000000, "1"}};
+
+void Inc(std::atomic<uint64_t>* counter, uint64_t n = 1) {
+  counter->fetch_add(n, std::memory_order_relaxed);
+}
+
+uint64_t Get(const std::atomic<uint64_t>& counter) {
+  return counter.load(std::memory_order_relaxed);
+}
+
+void Describe(std::ostream& out, const char* name, const char* type,
+              const char* help) {
+  out << "# HELP " << name << " " << help << "\n";
+  out << "# TYPE " << name << " " << type << "\n";
+}
+
+void Counter(std::ostream& out, const char* name, const char* help,
+             uint64_t value) {
+  Describe(out, name, "counter", help);
+  out << name << " " << value << "\n";
+}
+
+}  // namespace
+
+void CountFrameReceived() { Inc(&frames_received); }
+void CountFrameCoalesced() { Inc(&frames_coalesced); }
+void CountFrameDropped() { Inc(&frames_dropped); }
+void CountReplySent() { Inc(&replies_sent); }
+
+void CountSessionOpened() {
+  sessions_active.fetch_add(1, std::memory_order_relaxed);
+}
+
+void CountSessionClosed() {
+  sessions_active.fetch_sub(1, std::memory_order_relaxed);
+}
+
+void RecordSolve(const SolveStats& stats) {
+  int status = stats.status;
+  if (status < 0 || status >= MPC::kStatusCount) {
+    status = MPC::kStatusCount - 1;
+  }
+  Inc(&solves_by_status[status]);
+
+  size_t bucket = 0;
+  while (bucket < kIterationBuckets - 1 &&
+         stats.iterations > kIterationBounds[bucket]) {
+    ++bucket;
+  }
+  Inc(&iteration_buckets[bucket]);
+  Inc(&iteration_sum, stats.iterations > 0 ? stats.iterations : 0);
+}
+
+void RecordWeightsReload(bool ok, double seconds) {
+  if (!ok) {
+    Inc(&weights_rejected);
+    return;
+  }
+  Inc(&weights_reloads);
+  weights_reload_ns.store(seconds > 0 ? seconds * 1e9 : 0,
+                          std::memory_order_relaxed);
+}
+
+void RecordFirstSolveAfterReload(double seconds) {
+  weights_first_solve_ns.store(seconds > 0 ? seconds * 1e9 : 0,
+                               std::memory_order_relaxed);
+}
+
+std::string RenderMetrics() {
+  std::ostringstream out;
+
+  Counter(out, "mpc_frames_received_total", "Websocket messages received.",
+          Get(frames_received));
+  Counter(out, "mpc_frames_coalesced_total",
+          "Frames replaced by a newer one before they were solved.",
+          Get(frames_coalesced));
+  Counter(out, "mpc_frames_dropped_total",
+          "Frames that could not be parsed or handled.", Get(frames_dropped));
+  Counter(out, "mpc_replies_sent_total", "Replies sent to the simulator.",
+          Get(replies_sent));
+
+  Describe(out, "mpc_sessions_active", "gauge", "Open simulator connections.");
+  out << "mpc_sessions_active "
+      << sessions_active.load(std::memory_order_relaxed) << "\n";
+
+  Describe(out, "mpc_solves_total", "counter",
+           "MPC solves by Ipopt result status.");
+  for (int status = 0; status < MPC::kStatusCount; ++status) {
+    out << "mpc_solves_total{status=\"" << MPC::StatusName(status) << "\"} "
+        << Get(solves_by_status[status]) << "\n";
+  }
+
+  Describe(out, "mpc_solve_iterations", "histogram",
+           "Ipopt iterations per solve.");
+  uint64_t cumulative = 0;
+  for (size_t i = 0; i < kIterationBuckets; ++i) {
+    cumulative += Get(iteration_buckets[i]);
+    out << "mpc_solve_iterations_bucket{le=\"";
+    if (i < kIterationBuckets - 1) {
+      out << kIterationBounds[i];
+    } else {
+      out << "+Inf";
+    }
+    out << "\"} " << cumulative << "\n";
+  }
+  out << "mpc_solve_iterations_sum " << Get(iteration_sum) << "\n";
+  out << "mpc_solve_iterations_count " << cumulative << "\n";
+
+  Describe(out, "mpc_weights_reloads_total", "counter",
+           "Versions of the weights file loaded or rejected.");
+  out << "mpc_weights_reloads_total{result=\"ok\"} " << Get(weights_reloads)
+      << "\n";
+  out << "mpc_weights_reloads_total{result=\"invalid\"} "
+      << Get(weights_rejected) << "\n";
+  Describe(out, "mpc_weights_reload_seconds", "gauge",
+           "From the weights file being written to the new weights being "
+           "in use, for the last reload.");
+  out << "mpc_weights_reload_seconds " << Get(weights_reload_ns) * 1e-9
+      << "\n";
+  Describe(out, "mpc_weights_first_solve_seconds", "gauge",
+           "The first solve with the last reloaded weights.");
+  out << "mpc_weights_first_solve_seconds "
+      << Get(weights_first_solve_ns) * 1e-9 << "\n";
+
+  Describe(out, "mpc_stage_seconds", "histogram",
+           "Time spent in each stage of the message path.");
+  for (int i = 0; i < kStageCount; ++i) {
+    const Stage stage = static_cast<Stage>(i);
+    const HistogramCounts h = AggregateStage(stage);
+    for (const LatencyBound& bound : kLatencyBounds) {
+      out << "mpc_stage_seconds_bucket{stage=\"" << StageName(stage)
+          << "\",le=\"" << bound.label << "\"} " << h.CountAtOrBelow(bound.ns)
+          << "\n";
+    }
+    const uint64_t count = h.CountAtOrBelow(UINT64_MAX);
+    out << "mpc_stage_seconds_bucket{stage=\"" << StageName(stage)
+        << "\",le=\"+Inf\"} " << count << "\n";
+    out << "mpc_stage_seconds_sum{stage=\"" << StageName(stage) << "\"} "
+        << h.sum_ns * 1e-9 << "\n";
+    out << "mpc_stage_seconds_count{stage=\"" << StageName(stage) << "\"} "
+        << count << "\n";
+  }
+
+  size_t inuse = 0;
+  size_t available = 0;
+  MPC::AllocatorStats(&inuse, &available);
+  Describe(out, "mpc_cppad_memory_inuse_bytes", "gauge",
+           "Memory held by CppAD tapes and vectors across solver threads.");
+  out << "mpc_cppad_memory_inuse_bytes " << inuse << "\n";
+  Describe(out, "mpc_cppad_memory_available_bytes", "gauge",
+           "Memory cached by CppAD's thread allocator for reuse.");
+  out << "mpc_cppad_memory_available_bytes " << available << "\n";
+
+  return out.str();
+}
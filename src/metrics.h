@@ -0,0 +1,34 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <string>
+#include "MPC.h"
+
+// Process-wide counters served on /metrics. Every function is thread safe;
+// the counters are relaxed atomics, updated at most a few times per frame.
+
+// A websocket message arrived.
+void CountFrameReceived();
+// A frame was replaced by a newer one from the same connection before the
+// solver got to it.
+void CountFrameCoalesced();
+// A frame could not be handled (bad JSON, missing fields).
+void CountFrameDropped();
+// A reply went out.
+void CountReplySent();
+// A connection opened or went away.
+void CountSessionOpened();
+void CountSessionClosed();
+// Status and iteration count of one MPC::Solve.
+void RecordSolve(const SolveStats& stats);
+// The weights file was reloaded, `seconds` after it was written, or was
+// rejected.
+void RecordWeightsReload(bool ok, double seconds);
+// A session's first solve with newly reloaded weights took `seconds`.
+void RecordFirstSolveAfterReload(double seconds);
+
+// All of the above plus the stage latency histograms and CppAD's allocator
+// statistics, in the Prometheus text exposition format.
+std::string RenderMetrics();
+
+#endif /* METRICS_H */
@@ -0,0 +1,800 @@
+// Micro and macro benchmarks of the control pipeline.
+//
+// Times each stage of the message path on fixed inputs: the first telemetry
+// frame the simulator sends, synthetic frames placed around the lake track
+// and, with --log, frames from a flight log recorded by `mpc --record`.
+// Results go to stdout as JSON (default) or CSV, one row per benchmark with
+// per-operation median, p99 and max in microseconds. With --perf each row
+// also gets hardware counters per operation, in total and split into the
+// JSON, polyfit, tape and Ipopt sections the operation went through.
+//
+// Usage: mpc_bench [--format=json|csv] [--filter=SUBSTR] [--samples=N]
+//                  [--solve-samples=N] [--track=CSV] [--log=PATH] [--perf]
+//                  [--controller=C]
+//
+// The solver benchmarks run the controller --controller picks, ipopt by
+// default, through the Controller interface the server uses.
+
+#include <math.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "Eigen-3.3/Eigen/Core"
+#include "Eigen-3.3/bench/BenchTimer.h"
+#include "MPC.h"
+#include "controller.h"
+#include "flight_recorder.h"
+#include "json.hpp"
+#include "mpc_config.h"
+#include "perf_counters.h"
+#include "polynomial.h"
+#include "sample_stats.h"
+#include "session.h"
+#include "spline_track.h"
+#include "steer_writer.h"
+#include "telemetry.h"
+#include "track.h"
+
+// for convenience
+using json = nlohmann::json;
+
+namespace {
+
+// The first frame the Unity simulator sends on the lake track
+const char kRecordedFrame[] =
+    "42[\"telemetry\",{\"ptsx\":[-32.16173,-43.49173,-61.09,-78.29172,"
+    "-93.05002,-107.7717],\"ptsy\":[113.361,105.941,92.88499,78.73102,"
+    "65.34102,50.57938],\"psi_unity\":4.12033,\"psi\":3.733651,\"x\":-40.62,"
+    "\"y\":108.73,\"steering_angle\":0,\"throttle\":0,\"speed\":0}]";
+
+// As Session takes it from the default config
+const double Lf = MPCParams().Lf;
+
+// Largest difference allowed between polyfit6x3 and polyfit at a waypoint
+const double kFitTolerance = 1e-6;
+
+struct BenchOptions {
+  std::string format = "json";
+  std::string filter;
+  size_t samples = 2000;
+  size_t solve_samples = 50;
+  std::string track = "../lake_track_waypoints.csv";
+  std::string log;
+  bool perf = false;
+  Controller::Backend controller = Controller::kIpopt;
+};
+
+// One telemetry frame and everything derived from it by the pipeline.
+struct Input {
+  std::string frame;
+  double px, py, psi, v, delta, a;
+  std::vector<double> ptsx, ptsy;
+  Eigen::VectorXd xs, ys;
+  Eigen::VectorXd coeffs;
+  Eigen::VectorXd state;
+  FrenetState frenet;
+};
+
+struct Result {
+  std::string name;
+  std::string params;
+  size_t samples;
+  size_t batch;
+  SampleSummary us;
+  // Per-operation counters: "total", then each section that ran
+  std::vector<std::pair<std::string, PerfSample>> perf;
+};
+
+// Per-operation difference of two counter readings.
+PerfSample PerOp(const PerfSample& start, const PerfSample& end, size_t ops) {
+  PerfSample d;
+  for (int i = 0; i < kPerfEventCount; ++i) {
+    d.valid[i] = end.valid[i];
+    d.value[i] = (end.value[i] - start.value[i]) / ops;
+  }
+  return d;
+}
+
+double Ipc(const PerfSample& s) {
+  return s.valid[kPerfCycles] && s.valid[kPerfInstructions] &&
+                 s.value[kPerfCycles] > 0
+             ? s.value[kPerfInstructions] / s.value[kPerfCycles]
+             : 0;
+}
+
+bool Selected(const BenchOptions& options, const std::string& name) {
+  return options.filter.empty() ||
+         name.find(options.filter) != std::string::npos;
+}
+
+// Time `samples` runs of `batch` calls to op(i) and summarize per call.
+template <typename Op>
+Result Run(const std::string& name, const std::string& params, size_t samples,
+           size_t batch, Op op) {
+  // Warm caches and lazily initialized state
+  for (size_t i = 0; i < batch; ++i) {
+    op(i);
+  }
+  Eigen::BenchTimer timer;
+  timer.reset();
+  std::vector<double> per_op;
+  per_op.reserve(samples);
+  const PerfCounters* counters = ThreadPerfCounters();
+  PerfSample perf_start;
+  PerfTotals section_start[kPerfSectionCount];
+  if (counters != nullptr) {
+    for (int s = 0; s < kPerfSectionCount; ++s) {
+      section_start[s] = ThreadPerfTotals(static_cast<PerfSectionId>(s));
+    }
+    perf_start = counters->Read();
+  }
+  size_t n = 0;
+  for (size_t s = 0; s < samples; ++s) {
+    timer.start();
+    for (size_t i = 0; i < batch; ++i) {
+      op(n++);
+    }
+    timer.stop();
+    per_op.push_back(timer.value(Eigen::REAL_TIMER) * 1e6 / batch);
+  }
+  Result result;
+  if (counters != nullptr) {
+    result.perf.push_back(
+        std::make_pair("total", PerOp(perf_start, counters->Read(), n)));
+    for (int s = 0; s < kPerfSectionCount; ++s) {
+      const PerfSectionId section = static_cast<PerfSectionId>(s);
+      const PerfTotals& end = ThreadPerfTotals(section);
+      if (end.entries > section_start[s].entries) {
+        result.perf.push_back(std::make_pair(
+            PerfSectionName(section),
+            PerOp(section_start[s].sum, end.sum, n)));
+      }
+    }
+  }
+  result.name = name;
+  result.params = params;
+  result.samples = samples;
+  result.batch = batch;
+  result.us = Summarize(&per_op);
+  return result;
+}
+
+// Largest difference between the curves of polyfit6x3 and the QR based
+// polyfit at the waypoints of any input, in meters.
+double FixedFitError(const std::vector<Input>& inputs) {
+  double error = 0;
+  for (const Input& in : inputs) {
+    const FitCoeffs fixed = polyfit6x3(in.xs, in.ys);
+    for (int i = 0; i < kFitPoints; ++i) {
+      error = std::max(error, fabs(polyeval(fixed, in.xs(i)) -
+                                   polyeval(in.coeffs, in.xs(i))));
+    }
+  }
+  return error;
+}
+
+// Run a frame through the pipeline up to the solver input.
+bool Prepare(const std::string& frame, Input* in) {
+  std::string s = hasData(frame);
+  if (s == "") {
+    return false;
+  }
+  auto j = json::parse(s);
+  if (j[0].get<std::string>() != "telemetry") {
+    return false;
+  }
+  in->frame = frame;
+  in->ptsx = j[1]["ptsx"].get<std::vector<double>>();
+  in->ptsy = j[1]["ptsy"].get<std::vector<double>>();
+  if (in->ptsx.size() < 6 || in->ptsx.size() != in->ptsy.size()) {
+    return false;
+  }
+  in->px = j[1]["x"];
+  in->py = j[1]["y"];
+  in->psi = j[1]["psi"];
+  in->v = j[1]["speed"];
+  in->delta = j[1]["steering_angle"];
+  in->a = j[1]["throttle"];
+
+  std::vector<double> x = in->ptsx, y = in->ptsy;
+  GlobalToVehicle(in->px, in->py, in->psi, &x, &y);
+  in->xs = Eigen::Map<Eigen::VectorXd>(x.data(), 6);
+  in->ys = Eigen::Map<Eigen::VectorXd>(y.data(), 6);
+  in->coeffs = polyfit(in->xs, in->ys, 3);
+
+  // Same latency-compensated state as Session
+  const double delay_t = 0.1;
+  double cte = polyeval(in->coeffs, 0);
+  double epsi = -atan(in->coeffs[1]);
+  in->state = Eigen::VectorXd(6);
+  in->state << in->v * delay_t, 0, in->v * -in->delta / Lf * delay_t,
+      in->v + in->a * delay_t, cte + in->v * sin(epsi) * delay_t,
+      epsi + in->v * -in->delta / Lf * delay_t;
+  const double kappa = polycurvature(FitCoeffs(in->coeffs), 0);
+  in->frenet.offset = -cte + in->v * sin(epsi) * delay_t;
+  in->frenet.heading_error = epsi + in->v * -in->delta / Lf * delay_t -
+                             kappa * in->v * delay_t;
+  in->frenet.v = in->state[3];
+  in->frenet.x = in->state[0];
+  in->frenet.y = in->state[1];
+  in->frenet.psi = in->state[2];
+  return true;
+}
+
+// Reference curvature at each of `N` steps `dt` apart ahead of the car, as
+// Session computes it for the Frenet model without a track.
+std::vector<double> StepCurvature(const Input& in, size_t N, double dt) {
+  const FitCoeffs coeffs = in.coeffs;
+  std::vector<double> curvature(N);
+  for (size_t t = 0; t < N; ++t) {
+    curvature[t] =
+        polycurvature(coeffs, in.v * 0.1 + in.frenet.v * dt * t);
+  }
+  return curvature;
+}
+
+// The default config with a horizon of N steps dt seconds apart. Each
+// controller in a sweep gets its own; they differ only in the horizon.
+std::shared_ptr<const MPCConfig> HorizonConfig(size_t N, double dt) {
+  MPCParams params;
+  params.N = N;
+  params.dt = dt;
+  std::string error;
+  std::shared_ptr<const MPCConfig> config = MPCConfig::Create(params, &error);
+  if (!config) {
+    std::cerr << error << std::endl;
+    exit(1);
+  }
+  return config;
+}
+
+typedef std::vector<ControlProblem, Eigen::aligned_allocator<ControlProblem>>
+    Problems;
+
+// Each input as a Cartesian problem with the reference from `reference`,
+// and no deadline.
+template <typename Reference>
+Problems CartesianProblems(const std::vector<Input>& inputs,
+                           Reference reference) {
+  Problems problems(inputs.size(), ControlProblem());
+  for (size_t i = 0; i < inputs.size(); ++i) {
+    ControlProblem& p = problems[i];
+    p.model = MPC::kCartesian;
+    for (int k = 0; k < 6; ++k) {
+      p.state[k] = inputs[i].state[k];
+    }
+    p.reference = reference(inputs[i]);
+    p.deadline = std::chrono::steady_clock::time_point::max();
+  }
+  return problems;
+}
+
+// Counts over a run of solves, for a result's params.
+struct SolveCounts {
+  uint64_t solves = 0;
+  uint64_t iterations = 0;
+  uint64_t failures = 0;
+
+  void Add(const SolveStats& stats) {
+    ++solves;
+    iterations += stats.iterations;
+    if (stats.status != MPC::kStatusSuccess) {
+      ++failures;
+    }
+  }
+
+  // Mean Ipopt iterations and the share of solves that did not succeed
+  std::string Params() const {
+    std::ostringstream out;
+    out << std::fixed << std::setprecision(1) << " iterations="
+        << (solves > 0 ? static_cast<double>(iterations) / solves : 0.0)
+        << std::setprecision(3) << " failure_rate="
+        << (solves > 0 ? static_cast<double>(failures) / solves : 0.0);
+    return out.str();
+  }
+};
+
+// Telemetry for a car placed along each segment of the track.
+std::vector<std::string> SyntheticFrames(const Track& track) {
+  std::vector<std::string> frames;
+  for (size_t i = 0; i < track.size(); ++i) {
+    size_t j = (i + 1) % track.size();
+    double hx = track.x()[j] - track.x()[i];
+    double hy = track.y()[j] - track.y()[i];
+    double heading = atan2(hy, hx);
+    // 30% along the segment, alternately a meter left and right of it
+    double side = i % 2 == 0 ? 1.0 : -1.0;
+    json t;
+    t["x"] = track.x()[i] + 0.3 * hx - side * sin(heading);
+    t["y"] = track.y()[i] + 0.3 * hy + side * cos(heading);
+    t["psi"] = heading + 0.05 * side;
+    t["speed"] = 50.0;
+    t["steering_angle"] = 0.02 * side;
+    t["throttle"] = 0.5;
+    std::vector<double> ptsx, ptsy;
+    for (size_t k = 0; k < 6; ++k) {
+      ptsx.push_back(track.x()[(i + k) % track.size()]);
+      ptsy.push_back(track.y()[(i + k) % track.size()]);
+    }
+    t["ptsx"] = ptsx;
+    t["ptsy"] = ptsy;
+    frames.push_back("42[\"telemetry\"," + t.dump() + "]");
+  }
+  return frames;
+}
+
+std::vector<std::string> LoggedFrames(const std::string& path) {
+  std::vector<std::string> frames;
+  FlightLog log;
+  if (!log.Open(path)) {
+    std::cerr << log.error() << std::endl;
+    return frames;
+  }
+  std::vector<LoggedFrame> block;
+  for (size_t b = 0; b < log.block_count(); ++b) {
+    if (!log.ReadBlock(b, &block)) {
+      break;
+    }
+    for (const LoggedFrame& f : block) {
+      frames.push_back(std::string(f.data, f.length));
+    }
+  }
+  return frames;
+}
+
+void PrintJson(const std::vector<Result>& results) {
+  json rows = json::array();
+  for (const Result& r : results) {
+    json row;
+    row["name"] = r.name;
+    row["params"] = r.params;
+    row["samples"] = r.samples;
+    row["batch"] = r.batch;
+    row["mean_us"] = r.us.mean;
+    row["median_us"] = r.us.median;
+    row["p99_us"] = r.us.p99;
+    row["max_us"] = r.us.max;
+    for (const auto& scope : r.perf) {
+      json counters;
+      for (int i = 0; i < kPerfEventCount; ++i) {
+        if (scope.second.valid[i]) {
+          counters[PerfEventName(static_cast<PerfEvent>(i))] =
+              scope.second.value[i];
+        }
+      }
+      counters["ipc"] = Ipc(scope.second);
+      row["perf"][scope.first] = counters;
+    }
+    rows.push_back(row);
+  }
+  json out;
+  out["benchmarks"] = rows;
+  std::cout << out.dump(2) << std::endl;
+}
+
+void PrintCsvCounters(const PerfSample& s) {
+  for (int i = 0; i < kPerfEventCount; ++i) {
+    std::cout << ",";
+    if (s.valid[i]) {
+      std::cout << s.value[i];
+    }
+  }
+  std::cout << "," << Ipc(s);
+}
+
+// With counters, sections get rows of their own named "<benchmark>.<section>"
+// with the timing columns left empty.
+void PrintCsv(const std::vector<Result>& results, bool perf) {
+  std::cout << "name,params,samples,batch,mean_us,median_us,p99_us,max_us";
+  if (perf) {
+    for (int i = 0; i < kPerfEventCount; ++i) {
+      std::cout << "," << PerfEventName(static_cast<PerfEvent>(i));
+    }
+    std::cout << ",ipc";
+  }
+  std::cout << std::endl;
+  for (const Result& r : results) {
+    std::cout << r.name << ",\"" << r.params << "\"," << r.samples << ","
+              << r.batch << "," << r.us.mean << "," << r.us.median << ","
+              << r.us.p99 << "," << r.us.max;
+    if (perf && !r.perf.empty()) {
+      PrintCsvCounters(r.perf[0].second);
+    }
+    std::cout << std::endl;
+    for (size_t i = 1; i < r.perf.size(); ++i) {
+      std::cout << r.name << "." << r.perf[i].first << ",\"" << r.params
+                << "\"," << r.samples << "," << r.batch << ",,,,";
+      PrintCsvCounters(r.perf[i].second);
+      std::cout << std::endl;
+    }
+  }
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  BenchOptions options;
+  for (int i = 1; i < argc; ++i) {
+    const char* arg = argv[i];
+    const char* eq = strchr(arg, '=');
+    std::string name = eq ? std::string(arg, eq - arg) : std::string(arg);
+    const char* value = eq ? eq + 1 : "";
+    if (name == "--format" &&
+        (strcmp(value, "json") == 0 || strcmp(value, "csv") == 0)) {
+      options.format = value;
+    } else if (name == "--filter") {
+      options.filter = value;
+    } else if (name == "--samples" && atoi(value) > 0) {
+      options.samples = static_cast<size_t>(atoi(value));
+    } else if (name == "--solve-samples" && atoi(value) > 0) {
+      options.solve_samples = static_cast<size_t>(atoi(value));
+    } else if (name == "--track") {
+      options.track = value;
+    } else if (name == "--log") {
+      options.log = value;
+    } else if (name == "--perf") {
+      options.perf = true;
+    } else if (name == "--controller" &&
+               Controller::ParseBackend(value, &options.controller)) {
+    } else {
+      std::cerr << "Usage: " << argv[0]
+                << " [--format=json|csv] [--filter=SUBSTR] [--samples=N]"
+                   " [--solve-samples=N] [--track=CSV] [--log=PATH] [--perf]"
+                   " [--controller=C]"
+                << std::endl;
+      return -1;
+    }
+  }
+
+  std::string perf_error;
+  if (options.perf && !EnablePerfCounters(&perf_error)) {
+    std::cerr << perf_error << "; continuing without counters" << std::endl;
+    options.perf = false;
+  }
+
+  // Inputs: the recorded first frame, synthetic frames around the track and
+  // optionally a flight log
+  std::vector<std::string> frames(1, kRecordedFrame);
+  Track track;
+  if (track.LoadCsv(options.track)) {
+    std::vector<std::string> synthetic = SyntheticFrames(track);
+    frames.insert(frames.end(), synthetic.begin(), synthetic.end());
+  } else {
+    std::cerr << "Failed to load track " << options.track
+              << "; using the recorded frame only" << std::endl;
+  }
+  if (!options.log.empty()) {
+    std::vector<std::string> logged = LoggedFrames(options.log);
+    frames.insert(frames.end(), logged.begin(), logged.end());
+  }
+  std::vector<Input> inputs;
+  for (const std::string& frame : frames) {
+    Input in;
+    if (Prepare(frame, &in)) {
+      inputs.push_back(in);
+    }
+  }
+  const size_t n = inputs.size();
+  const std::string params = "inputs=" + std::to_string(n);
+  std::vector<Result> results;
+
+  if (Selected(options, "parse")) {
+    results.push_back(Run("parse", params, options.samples, 10, [&](size_t i) {
+      std::string s = hasData(inputs[i % n].frame);
+      auto j = json::parse(s);
+      escape(&j);
+    }));
+  }
+
+  if (Selected(options, "transform")) {
+    double x[64], y[64];
+    results.push_back(
+        Run("transform", params, options.samples, 100, [&](size_t i) {
+          const Input& in = inputs[i % n];
+          const size_t points = std::min<size_t>(in.ptsx.size(), 64);
+          GlobalToVehicle(in.px, in.py, in.psi, in.ptsx.data(),
+                          in.ptsy.data(), points, x, y);
+          escape(x);
+          escape(y);
+        }));
+
+    // The whole track into each input's car frame
+    if (track.size() > 0) {
+      std::vector<double> track_x(track.size()), track_y(track.size());
+      results.push_back(Run(
+          "transform_track", params + " points=" + std::to_string(track.size()),
+          options.samples, 10, [&](size_t i) {
+            const Input& in = inputs[i % n];
+            GlobalToVehicle(in.px, in.py, in.psi, track.x(), track.y(),
+                            track.size(), track_x.data(), track_y.data());
+            escape(track_x.data());
+            escape(track_y.data());
+          }));
+    }
+  }
+
+  // Car positions onto the track map, through the grid and from the
+  // previous frame's projection
+  if (Selected(options, "project") && track.size() > 0) {
+    results.push_back(
+        Run("project", params, options.samples, 100, [&](size_t i) {
+          TrackProjection p =
+              track.Project(inputs[i % n].px, inputs[i % n].py);
+          escape(&p);
+        }));
+    std::vector<TrackProjection> hints(n);
+    for (size_t i = 0; i < n; ++i) {
+      hints[i] = track.Project(inputs[i].px, inputs[i].py);
+    }
+    results.push_back(
+        Run("project_hint", params, options.samples, 100, [&](size_t i) {
+          TrackProjection p =
+              track.Project(inputs[i % n].px, inputs[i % n].py, hints[i % n]);
+          escape(&p);
+        }));
+  }
+
+  // The same onto the spline fitted through the track, and lookups on it
+  if (Selected(options, "spline") && track.size() > 0) {
+    SplineTrack spline;
+    spline.Build(track);
+    results.push_back(
+        Run("spline_project", params, options.samples, 100, [&](size_t i) {
+          TrackProjection p =
+              spline.Project(inputs[i % n].px, inputs[i % n].py);
+          escape(&p);
+        }));
+    std::vector<TrackProjection> hints(n);
+    for (size_t i = 0; i < n; ++i) {
+      hints[i] = spline.Project(inputs[i].px, inputs[i].py);
+    }
+    results.push_back(Run(
+        "spline_project_hint", params, options.samples, 100, [&](size_t i) {
+          TrackProjection p = spline.Project(inputs[i % n].px,
+                                             inputs[i % n].py, hints[i % n]);
+          escape(&p);
+        }));
+    results.push_back(
+        Run("spline_at", params, options.samples, 100, [&](size_t i) {
+          SplinePoint p = spline.At(hints[i % n].s + 7.5);
+          escape(&p);
+        }));
+  }
+
+  if (Selected(options, "polyfit")) {
+    results.push_back(
+        Run("polyfit", params, options.samples, 100, [&](size_t i) {
+          Eigen::VectorXd c = polyfit(inputs[i % n].xs, inputs[i % n].ys, 3);
+          escape(c.data());
+        }));
+    std::vector<FitPoints, Eigen::aligned_allocator<FitPoints>> xs(n), ys(n);
+    for (size_t i = 0; i < n; ++i) {
+      xs[i] = inputs[i].xs;
+      ys[i] = inputs[i].ys;
+    }
+    results.push_back(
+        Run("polyfit6x3", params, options.samples, 100, [&](size_t i) {
+          FitCoeffs c = polyfit6x3(xs[i % n], ys[i % n]);
+          escape(c.data());
+        }));
+
+    const double error = FixedFitError(inputs);
+    std::cerr << "polyfit6x3 differs from polyfit by up to " << error
+              << " m at the waypoints" << std::endl;
+    if (error > kFitTolerance) {
+      std::cerr << "polyfit6x3 exceeds the tolerance of " << kFitTolerance
+                << " m" << std::endl;
+      return 1;
+    }
+  }
+
+  if (Selected(options, "polyeval")) {
+    double sum = 0;
+    results.push_back(
+        Run("polyeval", params, options.samples, 1000, [&](size_t i) {
+          sum += polyeval(inputs[i % n].coeffs, 2.5 * (i % 24 + 1));
+        }));
+    escape(&sum);
+
+    // What Session evaluates per message: the car's point and 24 display
+    // points, with slopes
+    std::vector<FitCoeffs, Eigen::aligned_allocator<FitCoeffs>> coeffs(n);
+    for (size_t i = 0; i < n; ++i) {
+      coeffs[i] = inputs[i].coeffs;
+    }
+    double x[25], y[25], slope[25];
+    for (int i = 0; i < 25; ++i) {
+      x[i] = 2.5 * i;
+    }
+    results.push_back(
+        Run("polyeval_batch", params + " points=25", options.samples, 100,
+            [&](size_t i) {
+              polyeval_batch(coeffs[i % n], x, 25, y, slope);
+              escape(y);
+              escape(slope);
+            }));
+    // The same in the scaled basis, as the session now holds the reference
+    std::vector<ScaledPoly, Eigen::aligned_allocator<ScaledPoly>> scaled(n);
+    for (size_t i = 0; i < n; ++i) {
+      scaled[i] = polyfit6x3_scaled(inputs[i].xs, inputs[i].ys);
+    }
+    results.push_back(
+        Run("polyeval_batch_scaled", params + " points=25", options.samples,
+            100, [&](size_t i) {
+              polyeval_batch(scaled[i % n], x, 25, y, slope);
+              escape(y);
+              escape(slope);
+            }));
+  }
+
+  // Solver over a sweep of horizon lengths and timesteps, with the
+  // reference in powers of x as polyfit returns it, and in the scaled basis
+  // the server fits and solves in
+  const bool solve = Selected(options, "solve");
+  const bool solve_scaled = Selected(options, "solve_scaled");
+  if (solve || solve_scaled) {
+    // Powers of x are powers of t with center 0 and half 1
+    const Problems unscaled =
+        CartesianProblems(inputs, [](const Input& in) {
+          ScaledPoly reference;
+          reference.coeffs = in.coeffs;
+          reference.center = 0;
+          reference.half = 1;
+          return reference;
+        });
+    const Problems scaled = CartesianProblems(inputs, [](const Input& in) {
+      return polyfit6x3_scaled(in.xs, in.ys);
+    });
+    const size_t horizons[] = {6, 8, 10, 15, 20};
+    const double timesteps[] = {0.05, 0.1, 0.15};
+    for (size_t N : horizons) {
+      for (double dt : timesteps) {
+        std::ostringstream solve_params;
+        solve_params << params << " N=" << N << " dt=" << dt;
+        std::unique_ptr<Controller> controller =
+            Controller::Create(options.controller, HorizonConfig(N, dt));
+        ControlResult result;
+        if (solve) {
+          SolveCounts counts;
+          results.push_back(Run("solve", solve_params.str(),
+                                options.solve_samples, 1, [&](size_t i) {
+                                  controller->Solve(unscaled[i % n], &result);
+                                  escape(&result.steer);
+                                  counts.Add(result.stats);
+                                }));
+          results.back().params += counts.Params();
+        }
+        if (solve_scaled) {
+          SolveCounts counts;
+          results.push_back(Run("solve_scaled", solve_params.str(),
+                                options.solve_samples, 1, [&](size_t i) {
+                                  controller->Solve(scaled[i % n], &result);
+                                  escape(&result.steer);
+                                  counts.Add(result.stats);
+                                }));
+          results.back().params += counts.Params();
+        }
+      }
+    }
+  }
+
+  // Cold starts against starts from the plan converged for the input before,
+  // a little back along the track or log, as a session gets from LapPlans
+  // after a reset or reconnect. The first input has none and starts cold.
+  if (Selected(options, "solve_lap")) {
+    std::ostringstream solve_params;
+    solve_params << params << " N=10 dt=0.1";
+    std::unique_ptr<Controller> controller =
+        Controller::Create(options.controller, MPCConfig::Default());
+    ControlResult result;
+    const Problems cold = CartesianProblems(inputs, [](const Input& in) {
+      return polyfit6x3_scaled(in.xs, in.ys);
+    });
+    Problems warm = cold;
+    std::vector<std::vector<double>> plans(n);
+    for (size_t i = 0; i < n; ++i) {
+      controller->Solve(cold[i], &result);
+      plans[i] = controller->last_plan();
+    }
+    for (size_t i = 1; i < n; ++i) {
+      warm[i].plan = plans[i - 1].empty() ? nullptr : plans[i - 1].data();
+    }
+    SolveCounts cold_counts;
+    results.push_back(Run("solve_lap_cold", solve_params.str(),
+                          options.solve_samples, 1, [&](size_t i) {
+                            controller->Solve(cold[i % n], &result);
+                            escape(&result.steer);
+                            cold_counts.Add(result.stats);
+                          }));
+    results.back().params += cold_counts.Params();
+    SolveCounts warm_counts;
+    results.push_back(Run("solve_lap_warm", solve_params.str(),
+                          options.solve_samples, 1, [&](size_t i) {
+                            controller->Solve(warm[i % n], &result);
+                            escape(&result.steer);
+                            warm_counts.Add(result.stats);
+                          }));
+    results.back().params += warm_counts.Params();
+  }
+
+  // The path-coordinate model on the same inputs and sweep
+  if (Selected(options, "solve_frenet")) {
+    const size_t horizons[] = {6, 8, 10, 15, 20};
+    const double timesteps[] = {0.05, 0.1, 0.15};
+    for (size_t N : horizons) {
+      for (double dt : timesteps) {
+        std::ostringstream solve_params;
+        solve_params << params << " N=" << N << " dt=" << dt;
+        std::vector<std::vector<double>> curvature;
+        for (const Input& in : inputs) {
+          curvature.push_back(StepCurvature(in, N, dt));
+        }
+        Problems problems(n, ControlProblem());
+        for (size_t i = 0; i < n; ++i) {
+          problems[i].model = MPC::kFrenet;
+          problems[i].frenet = inputs[i].frenet;
+          problems[i].curvature = curvature[i].data();
+          problems[i].deadline = std::chrono::steady_clock::time_point::max();
+        }
+        std::unique_ptr<Controller> controller =
+            Controller::Create(options.controller, HorizonConfig(N, dt));
+        ControlResult result;
+        SolveCounts counts;
+        results.push_back(Run(
+            "solve_frenet", solve_params.str(), options.solve_samples, 1,
+            [&](size_t i) {
+              controller->Solve(problems[i % n], &result);
+              escape(&result.steer);
+              counts.Add(result.stats);
+            }));
+        results.back().params += counts.Params();
+      }
+    }
+  }
+
+  if (Selected(options, "serialize")) {
+    // Reply sizes as sent with N = 10: 24 reference and 9 predicted points
+    std::vector<double> next_x(24), next_y(24), mpc_x(9), mpc_y(9);
+    for (size_t i = 0; i < next_x.size(); ++i) {
+      next_x[i] = 2.5 * (i + 1);
+      next_y[i] = polyeval(inputs[0].coeffs, next_x[i]);
+    }
+    for (size_t i = 0; i < mpc_x.size(); ++i) {
+      mpc_x[i] = 0.123456789 * (2 * i + 1);
+      mpc_y[i] = 0.123456789 * (2 * i + 2);
+    }
+    SteerWriter writer;
+    results.push_back(
+        Run("serialize", "", options.samples, 100, [&](size_t i) {
+          writer.Write(-0.0123456, 0.75, DoubleSpan(next_x.data(), 24),
+                       DoubleSpan(next_y.data(), 24),
+                       DoubleSpan(mpc_x.data(), 9),
+                       DoubleSpan(mpc_y.data(), 9));
+          escape(const_cast<char*>(writer.data()));
+        }));
+  }
+
+  if (Selected(options, "session")) {
+    Session session(false, nullptr, MPC::kCartesian, nullptr,
+                    options.controller);
+    results.push_back(Run("session", params, options.solve_samples, 1,
+                          [&](size_t i) {
+                            const std::string& f = inputs[i % n].frame;
+                            session.HandleMessage(f.data(), f.size());
+                          }));
+  }
+
+  if (options.format == "csv") {
+    PrintCsv(results, options.perf);
+  } else {
+    PrintJson(results);
+  }
+  return 0;
+}
@@ -0,0 +1,96 @@
+#include "mpc_config.h"
+#include <sstream>
+#include "MPC.h"
+
+namespace {
+
+// Empty if `params` are usable, else what is wrong with the first bad one.
+std::string Check(const MPCParams& p) {
+  std::ostringstream error;
+  if (p.N < 2 || p.N > ControlResult::kMaxSteps) {
+    error << "N must be from 2 to " << ControlResult::kMaxSteps << ", not "
+          << p.N;
+  } else if (!(p.dt > 0) || !isfinite(p.dt)) {
+    error << "dt must be positive, not " << p.dt;
+  } else if (!(p.Lf > 0) || !isfinite(p.Lf)) {
+    error << "Lf must be positive, not " << p.Lf;
+  } else if (!(p.max_steer > 0 && p.max_steer < M_PI / 2)) {
+    error << "max_steer must be between 0 and pi / 2, not " << p.max_steer;
+  } else if (!(p.max_accel > 0) || !isfinite(p.max_accel)) {
+    error << "max_accel must be positive, not " << p.max_accel;
+  } else if (p.print_level < 0 || p.print_level > 12) {
+    error << "print_level must be from 0 to 12, not " << p.print_level;
+  } else if (!(p.max_cpu_time > 0) || !isfinite(p.max_cpu_time)) {
+    error << "max_cpu_time must be positive, not " << p.max_cpu_time;
+  } else {
+    return CheckWeights(p.weights);
+  }
+  return error.str();
+}
+
+}  // namespace
+
+std::string CheckWeights(const MPCWeights& w) {
+  std::ostringstream error;
+  const double weights[] = {w.cte_w, w.epsi_w, w.v_w, w.actuator_w,
+                            w.change_steer_w, w.change_accel_w};
+  const double references[] = {w.ref_cte, w.ref_epsi, w.ref_v};
+  for (double weight : weights) {
+    if (!(weight >= 0) || !isfinite(weight)) {
+      error << "weights must be finite and not negative, not " << weight;
+      return error.str();
+    }
+  }
+  for (double reference : references) {
+    if (!isfinite(reference)) {
+      error << "references must be finite, not " << reference;
+      return error.str();
+    }
+  }
+  return error.str();
+}
+
+Horizon::Horizon(size_t N, double dt)
+    : N(N),
+      dt(dt),
+      x_start(0),
+      y_start(x_start + N),
+      psi_start(y_start + N),
+      v_start(psi_start + N),
+      cte_start(v_start + N),
+      epsi_start(cte_start + N),
+      delta_start(epsi_start + N),
+      a_start(delta_start + N - 1),
+      n_vars(N * 6 + (N - 1) * 2),
+      n_constraints(N * 6) {}
+
+FrenetHorizon::FrenetHorizon(size_t N, double dt)
+    : N(N),
+      dt(dt),
+      offset_start(0),
+      heading_error_start(offset_start + N),
+      v_start(heading_error_start + N),
+      delta_start(v_start + N),
+      a_start(delta_start + N - 1),
+      n_vars(N * 3 + (N - 1) * 2),
+      n_constraints(N * 3) {}
+
+MPCConfig::MPCConfig(const MPCParams& params)
+    : params_(params),
+      horizon_(params.N, params.dt),
+      frenet_(params.N, params.dt) {}
+
+std::shared_ptr<const MPCConfig> MPCConfig::Create(const MPCParams& params,
+                                                   std::string* error) {
+  *error = Check(params);
+  if (!error->empty()) {
+    return nullptr;
+  }
+  return std::shared_ptr<const MPCConfig>(new MPCConfig(params));
+}
+
+std::shared_ptr<const MPCConfig> MPCConfig::Default() {
+  static const std::shared_ptr<const MPCConfig> config(
+      new MPCConfig(MPCParams()));
+  return config;
+}
@@ -0,0 +1,114 @@
+#ifndef MPC_CONFIG_H
+#define MPC_CONFIG_H
+
+#include <math.h>
+#include <cstddef>
+#include <memory>
+#include <string>
+
+// References the MPC's cost pulls the state towards, and the weight of each
+// cost term.
+struct MPCWeights {
+  double ref_cte = 0;
+  double ref_epsi = 0;
+  double ref_v = 130;
+
+  double cte_w = 1500;
+  double epsi_w = 2000;
+  // 100 can't make sharpest turn
+  double v_w = 1;
+  double actuator_w = 10;
+  // 200 pretty good, 20: can't make sharpest curve
+  double change_steer_w = 1000;
+  // 10 good
+  double change_accel_w = 10;
+};
+
+// Empty if `weights` are usable, else what is wrong with the first bad one:
+// weights must be finite and not negative, references finite.
+std::string CheckWeights(const MPCWeights& weights);
+
+// Settings of an MPC. The defaults are the ones tuned for the lake track.
+struct MPCParams {
+  // Steps in the horizon and seconds between them
+  size_t N = 10;
+  double dt = 0.1;
+  // Front axle to center of gravity, in meters; see MPC.cpp
+  double Lf = 2.67;
+  // The weights solves use unless a ControlProblem brings its own
+  MPCWeights weights;
+  // Largest steering angle either way, in radians, and acceleration
+  double max_steer = 25 * M_PI / 180;
+  double max_accel = 1.0;
+  // Ipopt's print level, and the CPU seconds a solve may take when the
+  // problem has no deadline
+  int print_level = 0;
+  double max_cpu_time = 0.5;
+};
+
+// Length of the prediction horizon and where each state and actuator
+// trajectory lives inside the solver's variable vector.
+struct Horizon {
+  Horizon(size_t N, double dt);
+
+  size_t N;
+  double dt;
+
+  size_t x_start;
+  size_t y_start;
+  size_t psi_start;
+  size_t v_start;
+  size_t cte_start;
+  size_t epsi_start;
+  size_t delta_start;
+  size_t a_start;
+
+  size_t n_vars;
+  size_t n_constraints;
+};
+
+// Variable layout of the path-coordinate model (MPC::SolveFrenet): the
+// lateral offset, heading error and speed at each step, then the actuators.
+struct FrenetHorizon {
+  FrenetHorizon(size_t N, double dt);
+
+  size_t N;
+  double dt;
+
+  size_t offset_start;
+  size_t heading_error_start;
+  size_t v_start;
+  size_t delta_start;
+  size_t a_start;
+
+  size_t n_vars;
+  size_t n_constraints;
+};
+
+// MPCParams checked once and fixed from then on, with both formulations'
+// variable layouts worked out. Immutable, so any number of MPCs on any
+// threads can share one, and MPCs with different configs can run side by
+// side.
+class MPCConfig {
+ public:
+  // A config of `params`, or null with the reason in `error` if any of them
+  // is out of range.
+  static std::shared_ptr<const MPCConfig> Create(const MPCParams& params,
+                                                 std::string* error);
+
+  // The config of the default MPCParams.
+  static std::shared_ptr<const MPCConfig> Default();
+
+  const MPCParams& params() const { return params_; }
+  const Horizon& horizon() const { return horizon_; }
+  const FrenetHorizon& frenet() const { return frenet_; }
+
+ private:
+  explicit MPCConfig(const MPCParams& params);
+
+  const MPCParams params_;
+  const Horizon horizon_;
+  const FrenetHorizon frenet_;
+};
+
+#endif /* MPC_CONFIG_H */
@@ -0,0 +1,243 @@
+#include "perf_counters.h"
+#include <cerrno>
+#include <cstring>
+#include <iomanip>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+const char* const kEventNames[kPerfEventCount] = {
+    "cycles", "instructions", "cache_misses", "branch_misses", "page_faults"};
+
+const char* const kSectionNames[kPerfSectionCount] = {"json", "polyfit",
+                                                      "tape", "ipopt"};
+
+struct ThreadPerf {
+  PerfCounters counters;
+  PerfTotals totals[kPerfSectionCount];
+};
+
+// Set on threads that called EnablePerfCounters
+thread_local ThreadPerf* thread_perf = nullptr;
+
+void PrintPerfRow(std::ostream& out, const char* name, uint64_t entries,
+                  const PerfSample& sum, double divisor) {
+  out << std::left << std::setw(12) << name << std::right << std::setw(10)
+      << entries;
+  for (int i = 0; i < kPerfEventCount; ++i) {
+    out << std::setw(14);
+    if (sum.valid[i] && divisor > 0) {
+      out << sum.value[i] / divisor;
+    } else {
+      out << "-";
+    }
+    if (i == kPerfInstructions) {
+      out << std::setw(8);
+      if (sum.valid[kPerfCycles] && sum.valid[kPerfInstructions] &&
+          sum.value[kPerfCycles] > 0) {
+        out << std::setprecision(2)
+            << sum.value[kPerfInstructions] / sum.value[kPerfCycles]
+            << std::setprecision(1);
+      } else {
+        out << "-";
+      }
+    }
+  }
+  out << std::endl;
+}
+
+#ifdef __linux__
+struct EventConfig {
+  uint32_t type;
+  uint64_t config;
+};
+
+const EventConfig kEvents[kPerfEventCount] = {
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+    {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS}};
+
+int OpenEvent(const EventConfig& event, int group) {
+  perf_event_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = event.type;
+  attr.config = event.config;
+  attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED |
+                     PERF_FORMAT_TOTAL_TIME_RUNNING;
+  // User space only, which also works under perf_event_paranoid=2
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  return static_cast<int>(
+      syscall(__NR_perf_event_open, &attr, 0, -1, group, 0));
+}
+#endif
+
+}  // namespace
+
+const char* PerfEventName(PerfEvent event) { return kEventNames[event]; }
+
+const char* PerfSectionName(PerfSectionId section) {
+  return kSectionNames[section];
+}
+
+PerfSample::PerfSample() {
+  for (int i = 0; i < kPerfEventCount; ++i) {
+    valid[i] = false;
+    value[i] = 0;
+  }
+}
+
+PerfCounters::PerfCounters() : leader_(-1) {
+  for (int& fd : fds_) {
+    fd = -1;
+  }
+}
+
+PerfCounters::~PerfCounters() {
+#ifdef __linux__
+  for (int fd : fds_) {
+    if (fd >= 0) {
+      close(fd);
+    }
+  }
+#endif
+}
+
+bool PerfCounters::Open() {
+#ifdef __linux__
+  int first_errno = 0;
+  for (int i = 0; i < kPerfEventCount; ++i) {
+    fds_[i] = OpenEvent(kEvents[i], leader_);
+    if (fds_[i] < 0) {
+      // Not every PMU has every event (VMs often have none); skip it
+      if (first_errno == 0) {
+        first_errno = errno;
+      }
+      continue;
+    }
+    if (leader_ < 0) {
+      leader_ = fds_[i];
+    }
+  }
+  if (leader_ < 0) {
+    error_ = std::string("perf_event_open failed: ") + strerror(first_errno) +
+             " (see /proc/sys/kernel/perf_event_paranoid)";
+    return false;
+  }
+  ioctl(leader_, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+  ioctl(leader_, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+  return true;
+#else
+  error_ = "perf counters need Linux";
+  return false;
+#endif
+}
+
+PerfSample PerfCounters::Read() const {
+  PerfSample sample;
+#ifdef __linux__
+  if (leader_ < 0) {
+    return sample;
+  }
+  // nr, time_enabled, time_running, then one value per open event in the
+  // order they were opened
+  uint64_t data[3 + kPerfEventCount];
+  if (read(leader_, data, sizeof(data)) < 0) {
+    return sample;
+  }
+  const double scale =
+      data[2] > 0 ? static_cast<double>(data[1]) / data[2] : 0.0;
+  size_t next = 3;
+  for (int i = 0; i < kPerfEventCount; ++i) {
+    if (fds_[i] >= 0) {
+      sample.valid[i] = true;
+      sample.value[i] = data[next++] * scale;
+    }
+  }
+#endif
+  return sample;
+}
+
+PerfTotals::PerfTotals() : entries(0) {}
+
+bool EnablePerfCounters(std::string* error) {
+  if (thread_perf != nullptr) {
+    return true;
+  }
+  ThreadPerf* perf = new ThreadPerf;
+  if (!perf->counters.Open()) {
+    *error = perf->counters.error();
+    delete perf;
+    return false;
+  }
+  thread_perf = perf;
+  return true;
+}
+
+const PerfCounters* ThreadPerfCounters() {
+  return thread_perf ? &thread_perf->counters : nullptr;
+}
+
+const PerfTotals& ThreadPerfTotals(PerfSectionId section) {
+  static const PerfTotals empty;
+  return thread_perf ? thread_perf->totals[section] : empty;
+}
+
+void PrintPerfReport(std::ostream& out, uint64_t messages,
+                     uint64_t iterations) {
+  std::ios::fmtflags flags = out.flags();
+  std::streamsize precision = out.precision();
+  out << "perf counters per message (" << messages << " messages)"
+      << std::endl;
+  out << std::left << std::setw(12) << "section" << std::right
+      << std::setw(10) << "entries";
+  for (int i = 0; i < kPerfEventCount; ++i) {
+    out << std::setw(14) << PerfEventName(static_cast<PerfEvent>(i));
+    if (i == kPerfInstructions) {
+      out << std::setw(8) << "IPC";
+    }
+  }
+  out << std::endl;
+  out << std::fixed << std::setprecision(1);
+  for (int s = 0; s < kPerfSectionCount; ++s) {
+    const PerfSectionId section = static_cast<PerfSectionId>(s);
+    const PerfTotals& totals = ThreadPerfTotals(section);
+    PrintPerfRow(out, PerfSectionName(section), totals.entries, totals.sum,
+                 static_cast<double>(messages));
+  }
+  const PerfTotals& ipopt = ThreadPerfTotals(kPerfIpopt);
+  PrintPerfRow(out, "ipopt/iter", iterations, ipopt.sum,
+               static_cast<double>(iterations));
+  out.flags(flags);
+  out.precision(precision);
+}
+
+PerfSection::PerfSection(PerfSectionId section)
+    : section_(section),
+      counters_(thread_perf ? &thread_perf->counters : nullptr) {
+  if (counters_ != nullptr) {
+    start_ = counters_->Read();
+  }
+}
+
+PerfSection::~PerfSection() {
+  if (counters_ == nullptr) {
+    return;
+  }
+  PerfSample end = counters_->Read();
+  PerfTotals& totals = thread_perf->totals[section_];
+  ++totals.entries;
+  for (int i = 0; i < kPerfEventCount; ++i) {
+    totals.sum.valid[i] = end.valid[i];
+    totals.sum.value[i] += end.value[i] - start_.value[i];
+  }
+}
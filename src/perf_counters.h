@@ -0,0 +1,104 @@
+#ifndef PERF_COUNTERS_H
+#define PERF_COUNTERS_H
+
+#include <cstdint>
+#include <ostream>
+#include <string>
+
+// Hardware and software performance counters (Linux perf_event_open) for the
+// offline harnesses.
+//
+// A thread opts in with EnablePerfCounters(); from then on every PerfSection
+// it enters adds the counter deltas to the thread's totals for that section.
+// On other threads, and everywhere when perf events are unavailable, a
+// PerfSection only checks a thread-local pointer.
+
+enum PerfEvent {
+  kPerfCycles,
+  kPerfInstructions,
+  kPerfCacheMisses,
+  kPerfBranchMisses,
+  kPerfPageFaults,
+  kPerfEventCount
+};
+
+const char* PerfEventName(PerfEvent event);
+
+// Counter values, scaled up when the kernel had to multiplex the counters.
+struct PerfSample {
+  PerfSample();
+
+  // Whether each event could be opened
+  bool valid[kPerfEventCount];
+  double value[kPerfEventCount];
+};
+
+// Counters of the calling thread, read together as one group.
+class PerfCounters {
+ public:
+  PerfCounters();
+  ~PerfCounters();
+
+  // Open the counters for the calling thread. Events the CPU or kernel does
+  // not support are skipped; returns false with error() set if none opened.
+  bool Open();
+  const std::string& error() const { return error_; }
+
+  // Counts since Open(). Valid flags are unset when not open.
+  PerfSample Read() const;
+
+ private:
+  int leader_;
+  int fds_[kPerfEventCount];
+  std::string error_;
+};
+
+// Parts of the pipeline measured separately.
+enum PerfSectionId {
+  kPerfJson,     // json::parse of the event
+  kPerfPolyfit,  // polyfit
+  kPerfTape,     // CppAD tape recording and sparsity, before Ipopt starts
+  kPerfIpopt,    // Ipopt's iterations
+  kPerfSectionCount
+};
+
+const char* PerfSectionName(PerfSectionId section);
+
+// Accumulated counter deltas of one section.
+struct PerfTotals {
+  PerfTotals();
+
+  uint64_t entries;
+  PerfSample sum;
+};
+
+// Start counting on the calling thread. Returns false (and sets `error`) if
+// no perf event could be opened.
+bool EnablePerfCounters(std::string* error);
+
+// The calling thread's counters, or nullptr if it did not enable them.
+const PerfCounters* ThreadPerfCounters();
+
+// Totals of `section` on the calling thread since EnablePerfCounters.
+const PerfTotals& ThreadPerfTotals(PerfSectionId section);
+
+// Per-message counts, IPC and misses of every section on the calling thread,
+// one line per section, plus Ipopt per iteration. `messages` and
+// `iterations` are what the totals are divided by.
+void PrintPerfReport(std::ostream& out, uint64_t messages,
+                     uint64_t iterations);
+
+// Adds the counts between construction and destruction to a section of the
+// calling thread's totals.
+class PerfSection {
+ public:
+  explicit PerfSection(PerfSectionId section);
+  ~PerfSection();
+
+ private:
+  const PerfSectionId section_;
+  PerfCounters* counters_;
+  PerfSample start_;
+};
+
+#endif /* PERF_COUNTERS_H */
@@ -0,0 +1,105 @@
+#include "polynomial.h"
+#include <cassert>
+#include "Eigen-3.3/Eigen/Cholesky"
+#include "Eigen-3.3/Eigen/QR"
+
+// Evaluate a polynomial.
+double polyeval(const Eigen::VectorXd& coeffs, double x) {
+  double result = 0.0;
+  for (int i = coeffs.size() - 1; i >= 0; i--) {
+    result = result * x + coeffs[i];
+  }
+  return result;
+}
+
+// Fit a polynomial.
+// Adapted from
+// https://github.com/JuliaMath/Polynomials.jl/blob/master/src/Polynomials.jl#L676-L716
+Eigen::VectorXd polyfit(Eigen::VectorXd xvals, Eigen::VectorXd yvals,
+                        int order) {
+  assert(xvals.size() == yvals.size());
+  assert(order >= 1 && order <= xvals.size() - 1);
+  Eigen::MatrixXd A(xvals.size(), order + 1);
+
+  for (int i = 0; i < xvals.size(); i++) {
+    A(i, 0) = 1.0;
+  }
+
+  for (int j = 0; j < xvals.size(); j++) {
+    for (int i = 0; i < order; i++) {
+      A(j, i + 1) = A(j, i) * xvals(j);
+    }
+  }
+
+  auto Q = A.householderQr();
+  auto result = Q.solve(yvals);
+  return result;
+}
+
+ScaledPoly polyfit6x3_scaled(const FitPoints& xvals, const FitPoints& yvals) {
+  // Fit in t = (x - center) / half, which spans [-1, 1]: powers of raw x
+  // (tens of meters) would square a condition number of ~1e7 in A^T A
+  const double lo = xvals.minCoeff();
+  const double hi = xvals.maxCoeff();
+  ScaledPoly poly;
+  poly.center = 0.5 * (lo + hi);
+  poly.half = hi > lo ? 0.5 * (hi - lo) : 1.0;
+  Eigen::Matrix<double, kFitPoints, kFitOrder + 1> A;
+  for (int i = 0; i < kFitPoints; ++i) {
+    const double t = (xvals(i) - poly.center) / poly.half;
+    A(i, 0) = 1.0;
+    for (int j = 0; j < kFitOrder; ++j) {
+      A(i, j + 1) = A(i, j) * t;
+    }
+  }
+  poly.coeffs = (A.transpose() * A).llt().solve(A.transpose() * yvals);
+  return poly;
+}
+
+FitCoeffs polyfit6x3(const FitPoints& xvals, const FitPoints& yvals) {
+  return polyunscale(polyfit6x3_scaled(xvals, yvals));
+}
+
+FitCoeffs polyunscale(const ScaledPoly& poly) {
+  // Horner's scheme on polynomials, with t = s x + o
+  const FitCoeffs& b = poly.coeffs;
+  const double s = 1.0 / poly.half;
+  const double o = -poly.center / poly.half;
+  FitCoeffs coeffs = FitCoeffs::Zero();
+  coeffs(0) = b(kFitOrder);
+  for (int k = kFitOrder - 1; k >= 0; --k) {
+    for (int i = kFitOrder; i > 0; --i) {
+      coeffs(i) = coeffs(i) * o + coeffs(i - 1) * s;
+    }
+    coeffs(0) = coeffs(0) * o + b(k);
+  }
+  return coeffs;
+}
+
+void polyeval_batch(const FitCoeffs& coeffs, const double* x, size_t n,
+                    double* y, double* dydx) {
+  static_assert(kFitOrder == 3, "Horner expressions below are cubic");
+  Eigen::Map<const Eigen::ArrayXd> xs(x, n);
+  // One expression each, so Eigen fuses them into a single pass over x
+  Eigen::Map<Eigen::ArrayXd>(y, n) =
+      ((coeffs(3) * xs + coeffs(2)) * xs + coeffs(1)) * xs + coeffs(0);
+  if (dydx != nullptr) {
+    Eigen::Map<Eigen::ArrayXd>(dydx, n) =
+        (3 * coeffs(3) * xs + 2 * coeffs(2)) * xs + coeffs(1);
+  }
+}
+
+void polyeval_batch(const ScaledPoly& poly, const double* x, size_t n,
+                    double* y, double* dydx) {
+  const FitCoeffs& b = poly.coeffs;
+  const double inv_half = 1.0 / poly.half;
+  Eigen::Map<const Eigen::ArrayXd> xs(x, n);
+  // An expression, fused into each of the two below
+  const auto ts = (xs - poly.center) * inv_half;
+  Eigen::Map<Eigen::ArrayXd>(y, n) =
+      ((b(3) * ts + b(2)) * ts + b(1)) * ts + b(0);
+  if (dydx != nullptr) {
+    Eigen::Map<Eigen::ArrayXd>(dydx, n) =
+        ((3 * b(3) * ts + 2 * b(2)) * ts + b(1)) * inv_half;
+  }
+}
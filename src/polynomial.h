@@ -0,0 +1,82 @@
+#ifndef POLYNOMIAL_H
+#define POLYNOMIAL_H
+
+#include <math.h>
+#include <cstddef>
+#include "Eigen-3.3/Eigen/Core"
+
+// Evaluate a polynomial.
+double polyeval(const Eigen::VectorXd& coeffs, double x);
+
+// Fit a polynomial of the given order through (xvals, yvals) by least squares.
+// Coefficients are returned lowest order first.
+Eigen::VectorXd polyfit(Eigen::VectorXd xvals, Eigen::VectorXd yvals,
+                        int order);
+
+// Waypoints the simulator sends with each frame and the order of the
+// reference polynomial fitted through them.
+const int kFitPoints = 6;
+const int kFitOrder = 3;
+typedef Eigen::Matrix<double, kFitPoints, 1> FitPoints;
+typedef Eigen::Matrix<double, kFitOrder + 1, 1> FitCoeffs;
+
+// A reference polynomial in the basis polyfit6x3 solves in: coefficients,
+// lowest order first, of powers of t = (x - center) / half, which spans
+// [-1, 1] over the points it was fitted through. In powers of x the
+// coefficients run from meters down to ~1e-5 1/m^2 for the cubic term;
+// in powers of t they are all of the order of the curve's offsets.
+struct ScaledPoly {
+  FitCoeffs coeffs;
+  double center;
+  double half;
+};
+
+// polyfit for kFitPoints points and order kFitOrder on fixed-size matrices,
+// without touching the heap. Solves the 4x4 normal equations by Cholesky
+// with x mapped onto [-1, 1], which keeps them well conditioned, and agrees
+// with polyfit to well under a micrometer on lake track windows (see the
+// check in mpc_bench). The first returns the polynomial in that basis, the
+// second in powers of x.
+ScaledPoly polyfit6x3_scaled(const FitPoints& xvals, const FitPoints& yvals);
+FitCoeffs polyfit6x3(const FitPoints& xvals, const FitPoints& yvals);
+
+// `poly` in powers of x.
+FitCoeffs polyunscale(const ScaledPoly& poly);
+
+// Evaluate a reference polynomial, lowest order first.
+inline double polyeval(const FitCoeffs& coeffs, double x) {
+  return ((coeffs(3) * x + coeffs(2)) * x + coeffs(1)) * x + coeffs(0);
+}
+
+inline double polyeval(const ScaledPoly& poly, double x) {
+  return polyeval(poly.coeffs, (x - poly.center) / poly.half);
+}
+
+// Signed curvature of a reference polynomial's graph at x, 1/m; positive
+// where it bends towards +y.
+inline double polycurvature(const FitCoeffs& coeffs, double x) {
+  const double slope = (3 * coeffs(3) * x + 2 * coeffs(2)) * x + coeffs(1);
+  const double bend = 6 * coeffs(3) * x + 2 * coeffs(2);
+  const double stretch = 1 + slope * slope;
+  return bend / (stretch * sqrt(stretch));
+}
+
+inline double polycurvature(const ScaledPoly& poly, double x) {
+  const FitCoeffs& b = poly.coeffs;
+  const double t = (x - poly.center) / poly.half;
+  const double slope = ((3 * b(3) * t + 2 * b(2)) * t + b(1)) / poly.half;
+  const double bend = (6 * b(3) * t + 2 * b(2)) / (poly.half * poly.half);
+  const double stretch = 1 + slope * slope;
+  return bend / (stretch * sqrt(stretch));
+}
+
+// Evaluate a reference polynomial at the `n` points `x` into `y` and, unless
+// null, its derivative into `dydx`. Horner's scheme over whole arrays, so
+// Eigen evaluates both with packet (SIMD) instructions, several points per
+// instruction.
+void polyeval_batch(const FitCoeffs& coeffs, const double* x, size_t n,
+                    double* y, double* dydx);
+void polyeval_batch(const ScaledPoly& poly, const double* x, size_t n,
+                    double* y, double* dydx);
+
+#endif /* POLYNOMIAL_H */
@@ -0,0 +1,189 @@
+#include "profiler.h"
+#include <cxxabi.h>
+#include <dlfcn.h>
+#include <execinfo.h>
+#include <signal.h>
+#include <sys/time.h>
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+
+namespace {
+
+// Frames kept per sample, counting the two below
+const int kMaxDepth = 64;
+// The signal handler and the kernel's signal trampoline
+const int kSkipFrames = 2;
+// Almost three minutes of one busy core; 17 MB
+const size_t kMaxSamples = 1 << 15;
+
+struct Sample {
+  int depth;
+  void* pcs[kMaxDepth];
+};
+
+// Shared with the signal handler. `samples` is set once by the first start
+// and never freed.
+Sample* samples = nullptr;
+std::atomic<bool> sampling(false);
+std::atomic<size_t> next_sample(0);
+// Handlers between their check of `sampling` and their last store
+std::atomic<int> active_handlers(0);
+
+// Guards starting and stopping
+std::mutex mutex;
+bool running = false;
+
+void OnSigprof(int) {
+  const int saved_errno = errno;
+  active_handlers.fetch_add(1);
+  if (sampling.load()) {
+    const size_t i = next_sample.fetch_add(1, std::memory_order_relaxed);
+    if (i < kMaxSamples) {
+      samples[i].depth = backtrace(samples[i].pcs, kMaxDepth);
+    }
+  }
+  active_handlers.fetch_sub(1);
+  errno = saved_errno;
+}
+
+bool SetTimer(int hz) {
+  itimerval timer;
+  timer.it_interval.tv_sec = 0;
+  timer.it_interval.tv_usec = hz > 0 ? 1000000 / hz : 0;
+  timer.it_value = timer.it_interval;
+  return setitimer(ITIMER_PROF, &timer, nullptr) == 0;
+}
+
+// Function name of `pc`, or "module+0xoffset" for symbols the dynamic
+// symbol table does not have (static functions; the executable's own unless
+// linked with -rdynamic).
+std::string Symbolize(void* pc) {
+  Dl_info info;
+  if (dladdr(pc, &info) == 0) {
+    char hex[32];
+    snprintf(hex, sizeof(hex), "%p", pc);
+    return hex;
+  }
+  if (info.dli_sname != nullptr) {
+    int status = 0;
+    char* demangled =
+        abi::__cxa_demangle(info.dli_sname, nullptr, nullptr, &status);
+    std::string name = status == 0 ? demangled : info.dli_sname;
+    free(demangled);
+    return name;
+  }
+  const char* module = info.dli_fname ? info.dli_fname : "?";
+  const char* slash = strrchr(module, '/');
+  char offset[32];
+  snprintf(offset, sizeof(offset), "+0x%zx",
+           static_cast<size_t>(static_cast<char*>(pc) -
+                               static_cast<char*>(info.dli_fbase)));
+  return std::string(slash ? slash + 1 : module) + offset;
+}
+
+std::string FoldSamples(size_t count) {
+  std::unordered_map<void*, std::string> symbols;
+  std::map<std::string, uint64_t> stacks;
+  std::string stack;
+  for (size_t i = 0; i < count; ++i) {
+    const Sample& sample = samples[i];
+    stack.clear();
+    for (int f = sample.depth - 1; f >= kSkipFrames; --f) {
+      // Callers' entries are return addresses; step back into the call so
+      // it resolves to the calling function even at its very end
+      void* pc = sample.pcs[f];
+      if (f > kSkipFrames) {
+        pc = static_cast<char*>(pc) - 1;
+      }
+      auto symbol = symbols.find(pc);
+      if (symbol == symbols.end()) {
+        symbol = symbols.emplace(pc, Symbolize(pc)).first;
+      }
+      if (!stack.empty()) {
+        stack += ';';
+      }
+      stack += symbol->second;
+    }
+    if (!stack.empty()) {
+      ++stacks[stack];
+    }
+  }
+  std::string folded;
+  for (const auto& entry : stacks) {
+    folded += entry.first;
+    folded += ' ';
+    folded += std::to_string(entry.second);
+    folded += '\n';
+  }
+  return folded;
+}
+
+}  // namespace
+
+bool StartProfiler(std::string* error) {
+  std::lock_guard<std::mutex> lock(mutex);
+  if (running) {
+    *error = "Profiler already running";
+    return false;
+  }
+  if (samples == nullptr) {
+    // Installed for good: a SIGPROF still pending after a stop must not
+    // take the default action and kill the process
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = OnSigprof;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    if (sigaction(SIGPROF, &action, nullptr) != 0) {
+      *error = std::string("sigaction failed: ") + strerror(errno);
+      return false;
+    }
+    // The first backtrace() loads the unwinder, which must not happen in
+    // the signal handler
+    void* warm_up[1];
+    backtrace(warm_up, 1);
+    samples = new Sample[kMaxSamples];
+  }
+  next_sample.store(0);
+  sampling.store(true);
+  if (!SetTimer(kProfilerHz)) {
+    sampling.store(false);
+    *error = std::string("setitimer failed: ") + strerror(errno);
+    return false;
+  }
+  running = true;
+  return true;
+}
+
+bool ProfilerRunning() {
+  std::lock_guard<std::mutex> lock(mutex);
+  return running;
+}
+
+std::string StopProfiler() {
+  std::lock_guard<std::mutex> lock(mutex);
+  if (!running) {
+    return std::string();
+  }
+  SetTimer(0);
+  sampling.store(false);
+  while (active_handlers.load() > 0) {
+    std::this_thread::yield();
+  }
+  running = false;
+  const size_t taken = next_sample.load();
+  if (taken > kMaxSamples) {
+    std::cerr << "Profiler dropped " << taken - kMaxSamples << " of " << taken
+              << " samples" << std::endl;
+  }
+  return FoldSamples(std::min(taken, kMaxSamples));
+}
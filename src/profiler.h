@@ -0,0 +1,31 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <string>
+
+// Sampling CPU profiler for the running server.
+//
+// While running, an ITIMER_PROF timer sends SIGPROF at kProfilerHz per
+// second of CPU time the process uses, and the signal handler stores the
+// interrupted thread's stack in a buffer allocated by the first start. When
+// the buffer is full further samples are counted and dropped. Stopping
+// symbolizes the samples and returns them as folded stacks, one
+// "outer;...;inner count" line per distinct stack, the input format of
+// flamegraph.pl and speedscope.
+//
+// Start and stop may be called from any thread.
+
+// Off the common 100 Hz timer ticks to avoid sampling in lockstep with them
+const int kProfilerHz = 199;
+
+// Start sampling. Returns false with `error` set if already running or the
+// timer cannot be set.
+bool StartProfiler(std::string* error);
+
+bool ProfilerRunning();
+
+// Stop sampling and return what was collected as folded stacks. Empty if
+// the profiler was not running.
+std::string StopProfiler();
+
+#endif /* PROFILER_H */
@@ -0,0 +1,266 @@
+// Replays telemetry recorded with `mpc --record=...` through the controller
+// pipeline, without a simulator, and reports per-stage latency percentiles.
+//
+// Usage: mpc_replay [--realtime] [--limit=N] [--linear-solver=S]
+//                   [--model=M] [--controller=C] [--trace=PATH] [--perf]
+//                   [--no-heap=STAGES] [--track=FILE] [--weights=FILE] log...
+//
+// By default frames are fed back to back as fast as the pipeline allows;
+// --realtime waits between frames to keep the recorded pacing. --trace
+// writes a Chrome trace of every stage and Ipopt iteration. --perf adds
+// hardware counters (cycles, instructions, cache and branch misses, page
+// faults) per message for JSON parsing, polyfit, taping and Ipopt. Builds
+// with MPC_ALLOC_PROFILE also report heap allocations per stage, and
+// --no-heap aborts on the first allocation in the given stages. --track
+// takes the reference from a track map, compiled or CSV, as `mpc --track`
+// does, and --model and --controller pick the MPC formulation and the
+// controller that solves it as they do for `mpc`. --weights solves with the
+// cost weights in a JSON file, loaded once.
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include "MPC.h"
+#include "alloc_profile.h"
+#include "controller.h"
+#include "flight_recorder.h"
+#include "lap_plans.h"
+#include "live_weights.h"
+#include "perf_counters.h"
+#include "sample_stats.h"
+#include "session.h"
+#include "spline_track.h"
+#include "trace.h"
+#include "track_file.h"
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+struct StageSamples {
+  std::vector<double> frame;
+  std::vector<double> parse;
+  std::vector<double> transform;
+  std::vector<double> fit;
+  std::vector<double> predict;
+  std::vector<double> solve;
+  std::vector<double> serialize;
+  std::vector<double> total;
+};
+
+void PrintSummary(const char* name, std::vector<double>* seconds) {
+  SampleSummary s = Summarize(seconds);
+  const double us = 1e6;
+  std::cout << std::left << std::setw(10) << name << std::right
+            << std::setw(8) << s.count << std::fixed << std::setprecision(1)
+            << std::setw(12) << s.median * us << std::setw(12) << s.p90 * us
+            << std::setw(12) << s.p99 * us << std::setw(12) << s.max * us
+            << std::endl;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  bool realtime = false;
+  bool perf = false;
+  uint64_t limit = 0;
+  std::string linear_solver = "mumps";
+  MPC::Model model = MPC::kCartesian;
+  Controller::Backend controller = Controller::kIpopt;
+  std::string trace_path;
+  std::string no_heap_stages;
+  std::string track_path;
+  std::string weights_path;
+  std::vector<std::string> paths;
+  for (int i = 1; i < argc; ++i) {
+    if (strcmp(argv[i], "--realtime") == 0) {
+      realtime = true;
+    } else if (strncmp(argv[i], "--limit=", 8) == 0) {
+      limit = strtoull(argv[i] + 8, nullptr, 10);
+    } else if (strncmp(argv[i], "--linear-solver=", 16) == 0) {
+      linear_solver = argv[i] + 16;
+    } else if (strncmp(argv[i], "--model=", 8) == 0 &&
+               MPC::ParseModel(argv[i] + 8, &model)) {
+    } else if (strncmp(argv[i], "--controller=", 13) == 0 &&
+               Controller::ParseBackend(argv[i] + 13, &controller)) {
+    } else if (strcmp(argv[i], "--perf") == 0) {
+      perf = true;
+    } else if (strncmp(argv[i], "--trace=", 8) == 0) {
+      trace_path = argv[i] + 8;
+    } else if (strncmp(argv[i], "--track=", 8) == 0) {
+      track_path = argv[i] + 8;
+    } else if (strncmp(argv[i], "--weights=", 10) == 0) {
+      weights_path = argv[i] + 10;
+    } else if (strncmp(argv[i], "--no-heap=", 10) == 0) {
+      no_heap_stages = argv[i] + 10;
+    } else if (argv[i][0] == '-') {
+      std::cerr << "Usage: " << argv[0]
+                << " [--realtime] [--limit=N] [--linear-solver=S]"
+                   " [--model=M] [--controller=C] [--trace=PATH] [--perf]"
+                   " [--no-heap=STAGES] [--track=FILE] [--weights=FILE]"
+                   " log..."
+                << std::endl;
+      return -1;
+    } else {
+      paths.push_back(argv[i]);
+    }
+  }
+  if (paths.empty()) {
+    std::cerr << "No flight logs given" << std::endl;
+    return -1;
+  }
+  MPC::SetupThreads(1, linear_solver);
+  std::string error;
+  if (!no_heap_stages.empty() && !SetNoHeapStages(no_heap_stages, &error)) {
+    std::cerr << error << std::endl;
+    return -1;
+  }
+  if (!trace_path.empty() && !StartTracing(trace_path)) {
+    std::cerr << "Failed to open " << trace_path << std::endl;
+    return -1;
+  }
+  TrackFile track_file;
+  const SplineTrack* track_map = nullptr;
+  if (!track_path.empty()) {
+    if (!track_file.Open(track_path)) {
+      std::cerr << "Failed to load track: " << track_file.error() << std::endl;
+      return -1;
+    }
+    track_map = &track_file.track();
+  }
+  std::unique_ptr<LiveWeights> weights;
+  if (!weights_path.empty()) {
+    MPCWeights loaded = MPCParams().weights;
+    if (!LoadWeights(weights_path, &loaded, &error)) {
+      std::cerr << "Failed to load weights: " << error << std::endl;
+      return -1;
+    }
+    weights.reset(new LiveWeights(loaded));
+  }
+  // Plans by track position, shared by all sessions as within a shard
+  std::unique_ptr<LapPlans> plans;
+  if (track_map != nullptr) {
+    plans.reset(new LapPlans(track_map->length()));
+  }
+  std::string perf_error;
+  if (perf && !EnablePerfCounters(&perf_error)) {
+    std::cerr << perf_error << "; continuing without counters" << std::endl;
+    perf = false;
+  }
+
+  StageSamples samples;
+  uint64_t frames = 0;
+  uint64_t replies = 0;
+  uint64_t dropped = 0;
+  uint64_t iterations = 0;
+  Clock::time_point run_start = Clock::now();
+
+  for (const std::string& path : paths) {
+    FlightLog log;
+    if (!log.Open(path)) {
+      std::cerr << log.error() << std::endl;
+      return -1;
+    }
+    std::cout << path << ": " << log.frame_count() << " frames in "
+              << log.block_count() << " blocks" << std::endl;
+
+    // Recorded connections each get their own session, as in the server
+    std::map<uint32_t, std::unique_ptr<Session>> sessions;
+    std::vector<LoggedFrame> block;
+    Clock::time_point replay_start = Clock::now();
+    // Pace from the first frame; the log may have been idle before it
+    int64_t log_start = -1;
+
+    for (size_t b = 0;
+         b < log.block_count() && (limit == 0 || frames < limit); ++b) {
+      if (!log.ReadBlock(b, &block)) {
+        std::cerr << path << ": " << log.error() << std::endl;
+        break;
+      }
+      for (const LoggedFrame& frame : block) {
+        if (limit > 0 && frames >= limit) {
+          break;
+        }
+        if (log_start < 0) {
+          log_start = frame.steady_ns;
+        }
+        if (realtime) {
+          std::this_thread::sleep_until(
+              replay_start +
+              std::chrono::nanoseconds(frame.steady_ns - log_start));
+        }
+
+        std::unique_ptr<Session>& session = sessions[frame.connection];
+        if (!session) {
+          session.reset(new Session(false, track_map, model, plans.get(),
+                                    controller, MPCConfig::Default(),
+                                    weights.get()));
+        }
+        TraceScope scope(frame.connection, frames + 1);
+        Clock::time_point start = Clock::now();
+        bool replied = false;
+        try {
+          replied = session->HandleMessage(frame.data, frame.length);
+        } catch (const std::exception& e) {
+          // Recorded before parsing, so logs keep frames the server
+          // dropped: malformed JSON or missing telemetry fields
+          ++frames;
+          ++dropped;
+          std::cerr << "Dropped frame " << frames << ": " << e.what()
+                    << std::endl;
+          continue;
+        }
+        double total =
+            std::chrono::duration<double>(Clock::now() - start).count();
+        ++frames;
+
+        // Manual-mode frames do not go through the pipeline
+        if (replied && session->handled_telemetry()) {
+          const StageTimes& t = session->last_times();
+          samples.frame.push_back(t.frame);
+          samples.parse.push_back(t.parse);
+          samples.transform.push_back(t.transform);
+          samples.fit.push_back(t.fit);
+          samples.predict.push_back(t.predict);
+          samples.solve.push_back(t.solve);
+          samples.serialize.push_back(t.serialize);
+          samples.total.push_back(total);
+          iterations += session->last_result().stats.iterations;
+          ++replies;
+        }
+      }
+    }
+  }
+
+  double elapsed =
+      std::chrono::duration<double>(Clock::now() - run_start).count();
+  StopTracing();
+  std::cout << frames << " frames, " << replies << " telemetry replies, "
+            << dropped << " dropped in " << elapsed << " s (" << frames / elapsed << " frames/s)"
+            << std::endl;
+  std::cout << std::left << std::setw(10) << "stage" << std::right
+            << std::setw(8) << "count" << std::setw(12) << "p50 us"
+            << std::setw(12) << "p90 us" << std::setw(12) << "p99 us"
+            << std::setw(12) << "max us" << std::endl;
+  PrintSummary("frame", &samples.frame);
+  PrintSummary("parse", &samples.parse);
+  PrintSummary("transform", &samples.transform);
+  PrintSummary("fit", &samples.fit);
+  PrintSummary("predict", &samples.predict);
+  PrintSummary("solve", &samples.solve);
+  PrintSummary("serialize", &samples.serialize);
+  PrintSummary("total", &samples.total);
+  if (perf) {
+    PrintPerfReport(std::cout, replies, iterations);
+  }
+  PrintAllocReport(std::cout);
+  return 0;
+}
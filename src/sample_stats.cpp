@@ -0,0 +1,34 @@
+#include "sample_stats.h"
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+
+namespace {
+
+// Nearest-rank percentile of sorted samples.
+double Percentile(const std::vector<double>& sorted, double p) {
+  return sorted[NearestRank(p, sorted.size()) - 1];
+}
+
+}  // namespace
+
+size_t NearestRank(double p, size_t n) {
+  const size_t rank = static_cast<size_t>(std::ceil(p * n));
+  return std::min(std::max<size_t>(rank, 1), n);
+}
+
+SampleSummary Summarize(std::vector<double>* samples) {
+  SampleSummary summary = SampleSummary();
+  if (samples->empty()) {
+    return summary;
+  }
+  std::sort(samples->begin(), samples->end());
+  summary.count = samples->size();
+  summary.mean =
+      std::accumulate(samples->begin(), samples->end(), 0.0) / samples->size();
+  summary.median = Percentile(*samples, 0.5);
+  summary.p90 = Percentile(*samples, 0.9);
+  summary.p99 = Percentile(*samples, 0.99);
+  summary.max = samples->back();
+  return summary;
+}
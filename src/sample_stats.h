@@ -0,0 +1,26 @@
+#ifndef SAMPLE_STATS_H
+#define SAMPLE_STATS_H
+
+#include <cstddef>
+#include <vector>
+
+// Order statistics of a set of samples, in the samples' unit.
+struct SampleSummary {
+  size_t count;
+  double mean;
+  double median;
+  double p90;
+  double p99;
+  double max;
+};
+
+// 1-based rank of the `p` quantile among `n` ordered samples by the
+// nearest-rank rule, ceil(p * n), kept within 1..n. Used by Summarize and by
+// the latency histograms so both report the same percentiles of the same
+// data.
+size_t NearestRank(double p, size_t n);
+
+// Summarize `samples`; sorts them in place. All fields are 0 when empty.
+SampleSummary Summarize(std::vector<double>* samples);
+
+#endif /* SAMPLE_STATS_H */
@@ -0,0 +1,115 @@
+#include "server_options.h"
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <thread>
+
+namespace {
+
+void PrintUsage(const char* program) {
+  std::cerr << "Usage: " << program << " [options]\n"
+            << "  --port=N            port to listen on (default 4567)\n"
+            << "  --threads=N         hubs and solver threads (default: one per core)\n"
+            << "  --latency-ms=N      actuator latency before each reply (default 100)\n"
+            << "  --linear-solver=S   Ipopt linear solver (default mumps)\n"
+            << "  --model=M           cartesian (default) or frenet, see MPC.h\n"
+            << "  --controller=C      ipopt (default), see controller.h\n"
+            << "  --verbose           print every frame and reply\n"
+            << "  --record=PATH       record telemetry to PATH.<shard> (see mpc_replay)\n"
+            << "  --trace=PATH        write a Chrome trace of every stage to PATH\n"
+            << "  --track=FILE        take the reference from this track map, compiled\n"
+            << "                      by track_compile or a waypoint CSV\n"
+            << "  --weights=FILE      cost weights as JSON, reloaded whenever FILE changes\n"
+            << "  --no-heap=STAGES    abort on allocation in STAGES (alloc profile builds)\n"
+            << "  --profile=PATH      where SIGUSR2 writes profiles (default mpc.folded)\n"
+            << "  --help              show this message\n";
+}
+
+// Returns the value of `--name=value` if `arg` is that flag, else nullptr.
+const char* FlagValue(const char* arg, const char* name) {
+  size_t n = strlen(name);
+  if (strncmp(arg, name, n) == 0 && arg[n] == '=') {
+    return arg + n + 1;
+  }
+  return nullptr;
+}
+
+bool ParseInt(const char* s, long min, long* out) {
+  char* end = nullptr;
+  long value = strtol(s, &end, 10);
+  if (end == s || *end != '\0' || value < min) {
+    return false;
+  }
+  *out = value;
+  return true;
+}
+
+}  // namespace
+
+ServerOptions::ServerOptions()
+    : port(4567),
+      threads(std::max(1u, std::thread::hardware_concurrency())),
+      latency_ms(100),
+      linear_solver("mumps"),
+      model(MPC::kCartesian),
+      controller(Controller::kIpopt),
+      verbose(false),
+      profile_path("mpc.folded") {}
+
+bool ParseServerOptions(int argc, char* argv[], ServerOptions* options) {
+  for (int i = 1; i < argc; ++i) {
+    const char* arg = argv[i];
+    const char* value = nullptr;
+    long n = 0;
+    bool ok = true;
+    if ((value = FlagValue(arg, "--port"))) {
+      ok = ParseInt(value, 1, &n) && n <= 65535;
+      options->port = static_cast<int>(n);
+    } else if ((value = FlagValue(arg, "--threads"))) {
+      ok = ParseInt(value, 1, &n);
+      options->threads = static_cast<size_t>(n);
+    } else if ((value = FlagValue(arg, "--latency-ms"))) {
+      ok = ParseInt(value, 0, &n);
+      options->latency_ms = static_cast<int>(n);
+    } else if ((value = FlagValue(arg, "--linear-solver"))) {
+      options->linear_solver = value;
+      ok = !options->linear_solver.empty();
+    } else if ((value = FlagValue(arg, "--model"))) {
+      ok = MPC::ParseModel(value, &options->model);
+    } else if ((value = FlagValue(arg, "--controller"))) {
+      ok = Controller::ParseBackend(value, &options->controller);
+    } else if ((value = FlagValue(arg, "--record"))) {
+      options->record_path = value;
+      ok = !options->record_path.empty();
+    } else if ((value = FlagValue(arg, "--trace"))) {
+      options->trace_path = value;
+      ok = !options->trace_path.empty();
+    } else if ((value = FlagValue(arg, "--track"))) {
+      options->track_path = value;
+      ok = !options->track_path.empty();
+    } else if ((value = FlagValue(arg, "--weights"))) {
+      options->weights_path = value;
+      ok = !options->weights_path.empty();
+    } else if ((value = FlagValue(arg, "--profile"))) {
+      options->profile_path = value;
+      ok = !options->profile_path.empty();
+    } else if ((value = FlagValue(arg, "--no-heap"))) {
+      options->no_heap_stages = value;
+      ok = !options->no_heap_stages.empty();
+    } else if (strcmp(arg, "--verbose") == 0) {
+      options->verbose = true;
+    } else if (strcmp(arg, "--help") == 0) {
+      PrintUsage(argv[0]);
+      return false;
+    } else {
+      ok = false;
+    }
+    if (!ok) {
+      std::cerr << "Invalid argument: " << arg << std::endl;
+      PrintUsage(argv[0]);
+      return false;
+    }
+  }
+  return true;
+}
@@ -0,0 +1,47 @@
+#ifndef SERVER_OPTIONS_H
+#define SERVER_OPTIONS_H
+
+#include <cstddef>
+#include <string>
+#include "MPC.h"
+#include "controller.h"
+
+// Command line settings of the mpc server.
+struct ServerOptions {
+  ServerOptions();
+
+  // Port shared by all shards
+  int port;
+  // Number of shards; each runs one uWS hub and one solver thread
+  size_t threads;
+  // Simulated actuator latency applied before each reply is sent
+  int latency_ms;
+  // Ipopt linear solver, see MPC::SetupThreads
+  std::string linear_solver;
+  // Formulation every session solves, see MPC::Model
+  MPC::Model model;
+  // Controller every session solves it with, see Controller::Backend
+  Controller::Backend controller;
+  // Echo every frame and reply to stdout
+  bool verbose;
+  // If set, every shard records incoming frames to "<record_path>.<shard>"
+  std::string record_path;
+  // If set, spans of every stage and Ipopt iteration are traced to this file
+  std::string trace_path;
+  // Stages that abort on heap allocation once warm, see alloc_profile.h
+  std::string no_heap_stages;
+  // If set, a track map the reference is taken from: a track_compile
+  // output or a waypoint CSV
+  std::string track_path;
+  // If set, a JSON file of cost weights (see LoadWeights), reloaded
+  // whenever it changes
+  std::string weights_path;
+  // Where SIGUSR2 writes the folded stacks of the sampling profiler
+  std::string profile_path;
+};
+
+// Parse `--name=value` style flags into `options`. Prints usage and returns
+// false on unknown flags or bad values.
+bool ParseServerOptions(int argc, char* argv[], ServerOptions* options);
+
+#endif /* SERVER_OPTIONS_H */
@@ -0,0 +1,332 @@
+#include "session.h"
+#include <math.h>
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "Eigen-3.3/Eigen/Core"
+#include "alloc_profile.h"
+#include "latency_histogram.h"
+#include "perf_counters.h"
+#include "polynomial.h"
+#include "telemetry.h"
+
+// for convenience
+using json = nlohmann::json;
+
+namespace {
+
+// For converting back and forth between radians and degrees.
+constexpr double pi() { return M_PI; }
+
+// Reference points taken from a track map: spacing and how far behind the
+// car the first one is, in meters. About the span of the simulator's six
+// waypoints.
+const double kMapSpacing = 15.0;
+const double kMapBehind = 10.0;
+
+// On a track map, the last frame's plan is no start for a car this far
+// from where it was solved, in meters: the simulator was reset
+const double kPlanReach = 10.0;
+
+// How long after a frame's JSON is parsed its actuations are due, in wall
+// time; the controller returns what it has by then
+const std::chrono::milliseconds kSolveDeadline(500);
+
+typedef std::chrono::steady_clock Clock;
+
+// Seconds elapsed since `start`; moves `start` to now for the next stage.
+// When tracing, also records the interval as a span of `stage`; when
+// profiling allocations, charges them to `stage`.
+double SecondsSince(Clock::time_point* start, Stage stage) {
+  EndAllocStage(stage);
+  Clock::time_point now = Clock::now();
+  double seconds = std::chrono::duration<double>(now - *start).count();
+  TraceSpan(StageName(stage), *start, now);
+  *start = now;
+  return seconds;
+}
+
+}  // namespace
+
+Session::Session(bool verbose, const SplineTrack* track, MPC::Model model,
+                 LapPlans* plans, Controller::Backend backend,
+                 std::shared_ptr<const MPCConfig> config,
+                 const LiveWeights* live_weights)
+    : verbose_(verbose),
+      track_(track),
+      model_(model),
+      plans_(track != nullptr ? plans : nullptr),
+      has_projection_(false),
+      config_(config),
+      controller_(Controller::Create(backend, config)),
+      live_weights_(live_weights),
+      weights_(live_weights != nullptr ? live_weights->Get() : nullptr),
+      first_after_reload_(false),
+      result_(),
+      plan_s_(0),
+      times_(),
+      handled_telemetry_(false),
+      messages_(0) {}
+
+bool Session::HandleMessage(const char* data, size_t length) {
+  // "42" at the start of the message means there's a websocket message event.
+  // The 4 signifies a websocket message
+  // The 2 signifies a websocket event
+  AllocMessageScope allocs(kStageFrame, kStageSerialize, messages_++);
+  Clock::time_point start = Clock::now();
+  handled_telemetry_ = false;
+  string sdata(data, length);
+  if (verbose_) {
+    cout << sdata << endl;
+  }
+  if (sdata.size() <= 2 || sdata[0] != '4' || sdata[1] != '2') {
+    return false;
+  }
+
+  string s = hasData(sdata);
+  if (s == "") {
+    // Manual driving
+    writer_.WriteManual();
+    return true;
+  }
+  times_.frame = SecondsSince(&start, kStageFrame);
+
+  json j;
+  {
+    PerfSection perf(kPerfJson);
+    j = json::parse(s);
+  }
+  string event = j[0].get<string>();
+  if (event != "telemetry") {
+    return false;
+  }
+  // j[1] is the data JSON object
+  HandleTelemetry(j[1], start);
+  handled_telemetry_ = true;
+  if (verbose_) {
+    cout.write(writer_.data(), writer_.length()) << endl;
+  }
+  return true;
+}
+
+void Session::HandleTelemetry(const json& telemetry, Clock::time_point start) {
+  // Counted from here, once the JSON is parsed, not from `start`
+  const Clock::time_point deadline = Clock::now() + kSolveDeadline;
+  // See MPC.cpp for explanation
+  const double Lf = config_->params().Lf;
+  double px = telemetry.at("x");  // car x-position
+  double py = telemetry.at("y");  // car y-position
+  double psi = telemetry.at("psi");  // car psi (heading)
+  double v = telemetry.at("speed");  // car velocity
+  double delta = telemetry.at("steering_angle");  // ''
+  double a = telemetry.at("throttle");  // acceleration
+
+  // Waypoints go into buffers kept across messages, which stop growing
+  // after the first
+  if (track_ != nullptr) {
+    // From the track map, evenly spaced from just behind the car
+    projection_ = has_projection_ ? track_->Project(px, py, projection_)
+                                  : track_->Project(px, py);
+    has_projection_ = true;
+    waypoints_x_.resize(kFitPoints);
+    waypoints_y_.resize(kFitPoints);
+    track_->PointsAlong(projection_.s - kMapBehind, kMapSpacing, kFitPoints,
+                        waypoints_x_.data(), waypoints_y_.data());
+  } else {
+    const json& ptsx = telemetry.at("ptsx");  // waypoints-x
+    const json& ptsy = telemetry.at("ptsy");  // waypoints-y
+    const size_t num_waypoints = std::min(ptsx.size(), ptsy.size());
+    if (num_waypoints < kFitPoints) {
+      throw std::runtime_error("Fewer waypoints than the fit needs");
+    }
+    waypoints_x_.resize(num_waypoints);
+    waypoints_y_.resize(num_waypoints);
+    for (size_t i = 0; i < num_waypoints; ++i) {
+      waypoints_x_[i] = ptsx[i];
+      waypoints_y_[i] = ptsy[i];
+    }
+  }
+  times_.parse = SecondsSince(&start, kStageParse);
+
+  // Transform pts (waypoints) to the car's coordinate system, in place
+  GlobalToVehicle(px, py, psi, &waypoints_x_, &waypoints_y_);
+
+  times_.transform = SecondsSince(&start, kStageTransform);
+
+  // Pointers to waypoints
+  double* ptrx = &waypoints_x_[0];
+  double* ptry = &waypoints_y_[0];
+
+  // View the first 6 waypoints as fixed-size Eigen vectors
+  Eigen::Map<FitPoints> ptsx_transform(ptrx);
+  Eigen::Map<FitPoints> ptsy_transform(ptry);
+
+  // Third order polynomial, kept in the scaled basis the fit solves in all
+  // the way into the solver
+  ScaledPoly poly;
+  {
+    PerfSection perf(kPerfPolyfit);
+    poly = polyfit6x3_scaled(ptsx_transform, ptsy_transform);
+  }
+  times_.fit = SecondsSince(&start, kStageFit);
+
+  // Yellow line in simulator (the line to follow)
+  // Line formed by polyfitting the waypoints
+  // Prediction horizon is the duration of future predictions (based on product of N and dt)
+  // N = 10; dt = 0.1
+  const double poly_inc = 2.5;  // x-value increment
+  const int num_points = 25; // number of future points to be plotted
+
+  // The guideline and its slope at the car (x = 0) and at the plotted
+  // points, all in one vectorized pass
+  double ref_x[num_points];
+  double ref_y[num_points];
+  double ref_slope[num_points];
+  for (int i = 0; i < num_points; ++i) {
+    ref_x[i] = poly_inc * i;
+  }
+  polyeval_batch(poly, ref_x, num_points, ref_y, ref_slope);
+
+  // Calculate cross track error: distance between car and polynomial guideline created from waypoints
+  double cte = ref_y[0];
+
+  // Error in car's orientation measured against the tangent of the guideline created from waypoints
+  // double epsi = psi - atan(coeffs[1] + 2 * px * coeffs[2] + 3 * coeffs[3] * pow(px, 2));
+  // psi and px are zero in the car's frame, which leaves the slope at x = 0:
+  double epsi;
+  if (track_ != nullptr) {
+    // Straight from the map: the center line is to the right of a car left
+    // of it, and its heading is tabulated
+    cte = -projection_.offset;
+    epsi = remainder(psi - track_->At(projection_.s).heading, 2 * pi());
+  } else {
+    epsi = -atan(ref_slope[0]);
+  }
+
+  // Latency for predicting time at actuation; in a real car there will be a delay in execution
+  const double delay_t = 0.1;  // delay in actuator execution in seconds
+
+  // Predict future state with latency taken into account
+  double delay_x = 0.0 + v * delay_t;  // psi is zero; omit
+  const double delay_y = 0.0;  // y remains zero
+  double delay_psi = 0.0 + v * -delta / Lf * delay_t;
+  double delay_v = v + a * delay_t;
+  double delay_cte = cte + v * sin(epsi) * delay_t;
+  double delay_epsi = epsi + v * -delta / Lf * delay_t;
+
+  // A state vector that includes cte and epsi will capture how these errors change over time
+  // Feed in the state values
+  ControlProblem problem = ControlProblem();
+  problem.model = model_;
+//state << 0, 0, 0, v, cte, epsi;  // delay not factored in (car doesn't last long on track)
+  // New state values that take latency into account
+  const double state[] = {delay_x, delay_y, delay_psi,
+                          delay_v, delay_cte, delay_epsi};
+  std::copy(state, state + 6, problem.state);
+  problem.reference = poly;
+  problem.deadline = deadline;
+  if (live_weights_ != nullptr) {
+    std::shared_ptr<const MPCWeights> weights = live_weights_->Get();
+    first_after_reload_ = weights != weights_;
+    weights_ = weights;
+    problem.weights = weights_.get();
+  }
+
+  // The same in path coordinates for the Frenet model, with the reference's
+  // curvature where the car will be at each step of the horizon
+  FrenetState& frenet = problem.frenet;
+  if (model_ == MPC::kFrenet) {
+    const double offset = -cte;
+    const double ahead = v * delay_t;
+    curvature_.resize(controller_->steps());
+    double kappa;
+    if (track_ != nullptr) {
+      kappa = track_->At(projection_.s).curvature;
+      for (size_t t = 0; t < curvature_.size(); ++t) {
+        curvature_[t] =
+            track_->At(projection_.s + ahead + delay_v * controller_->dt() * t)
+                .curvature;
+      }
+    } else {
+      // Along the polynomial, distance ahead is close enough to x
+      kappa = polycurvature(poly, 0);
+      for (size_t t = 0; t < curvature_.size(); ++t) {
+        curvature_[t] =
+            polycurvature(poly, ahead + delay_v * controller_->dt() * t);
+      }
+    }
+    frenet.offset = offset + v * sin(epsi) * delay_t;
+    frenet.heading_error =
+        epsi + v * -delta / Lf * delay_t - kappa * v * delay_t;
+    frenet.v = delay_v;
+    frenet.x = delay_x;
+    frenet.y = delay_y;
+    frenet.psi = delay_psi;
+    problem.curvature = curvature_.data();
+  }
+
+  // Where the solver starts: the last frame's plan a step on, if it
+  // converged; otherwise the plan stored near here on an earlier lap, or
+  // from rest
+  const double plan_s = track_ != nullptr ? projection_.s + v * delay_t : 0;
+  const std::vector<double>& last_plan = controller_->last_plan();
+  if (!last_plan.empty() &&
+      (track_ == nullptr ||
+       fabs(remainder(plan_s - plan_s_, track_->length())) < kPlanReach)) {
+    // Each actuator drops its first step and holds its last
+    const size_t steps = last_plan.size() / 2;
+    start_plan_.resize(last_plan.size());
+    for (size_t t = 0; t < steps; ++t) {
+      const size_t next = std::min(t + 1, steps - 1);
+      start_plan_[t] = last_plan[next];
+      start_plan_[steps + t] = last_plan[steps + next];
+    }
+    problem.plan = start_plan_.data();
+  } else if (plans_ != nullptr &&
+             plans_->Nearest(plan_s, delay_v, 2 * (controller_->steps() - 1),
+                             &start_plan_)) {
+    problem.plan = start_plan_.data();
+  }
+
+  times_.predict = SecondsSince(&start, kStagePredict);
+
+  // Ipopt is the tool used to optimize control inputs; it expects vectors for variables and constraints
+
+  // vars vector contains all variables used by the cost function and model
+  // [x,y,psi,v,cte,epsi] and [delta,a]
+  if (controller_->Solve(problem, &result_)) {
+    plan_s_ = plan_s;
+    if (plans_ != nullptr) {
+      plans_->Store(plan_s, delay_v, controller_->last_plan().data(),
+                    controller_->last_plan().size());
+    }
+  }
+  times_.solve = SecondsSince(&start, kStageSolve);
+
+  // Normalize steering angle range: [-deg2rad(25), deg2rad(25)] -> [-1, 1]
+  const double angle_norm_denom = config_->params().max_steer * Lf;
+  double steer_value = result_.steer / angle_norm_denom;
+  double throttle_value = result_.throttle;
+
+  // Display the MPC predicted trajectory (green line in simulator); vehicle's predicted path
+  // Steps after the one solved from
+  DoubleSpan mpc_x_vals(result_.x + 1, result_.steps - 1);
+  DoubleSpan mpc_y_vals(result_.y + 1, result_.steps - 1);
+
+  // plug data into simulator
+  // NOTE: Remember to divide by deg2rad(25) before you send the steering value back.
+  // Otherwise the values will be in between [-deg2rad(25), deg2rad(25] instead of [-1, 1].
+  //
+  // ref_x/ref_y past the car's own point: points in reference to the
+  // vehicle's coordinate system, connected by a Yellow line in the simulator.
+  // mpc_x/mpc_y: points in reference to the vehicle's coordinate system,
+  // connected by a Green line in the simulator.
+  writer_.Write(steer_value, throttle_value,
+                DoubleSpan(ref_x + 1, num_points - 1),
+                DoubleSpan(ref_y + 1, num_points - 1),
+                mpc_x_vals, mpc_y_vals);
+  times_.serialize = SecondsSince(&start, kStageSerialize);
+}
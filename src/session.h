@@ -0,0 +1,112 @@
+#ifndef SESSION_H
+#define SESSION_H
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include "MPC.h"
+#include "controller.h"
+#include "json.hpp"
+#include "lap_plans.h"
+#include "live_weights.h"
+#include "mpc_config.h"
+#include "spline_track.h"
+#include "steer_writer.h"
+
+// Wall time spent in each step of the last telemetry frame, in seconds.
+struct StageTimes {
+  double frame;
+  double parse;
+  double transform;
+  double fit;
+  double predict;
+  double solve;
+  double serialize;
+};
+
+// Controller state for one simulator connection.
+//
+// A session turns incoming Socket.IO frames into replies: it parses the
+// telemetry, moves the waypoints into the car's frame, fits the reference
+// polynomial, runs its own controller and serializes the "steer" event.
+// Sessions share nothing but the read-only track map and their shard's lap
+// plans, so sessions of different shards can be driven from different
+// threads.
+class Session {
+ public:
+  // With a `track`, the reference is taken from the map around the car's
+  // position instead of the waypoints in the telemetry, and the cross track
+  // and heading errors from the car's projection onto it. `model` picks the
+  // MPC formulation; the Frenet one takes the reference's curvature from
+  // the track, or from the fitted polynomial without one. The solver starts
+  // from the last frame's plan; without a recent one, from the plan in
+  // `plans`, if given with a track, stored where the car is on an earlier
+  // lap. Converged plans go back into `plans`. `backend` picks the
+  // controller that solves it, with the horizon, costs and bounds of
+  // `config`. With `live_weights`, each frame is solved with their current
+  // value instead of the config's, so they can change while the session
+  // runs.
+  explicit Session(
+      bool verbose = false, const SplineTrack* track = nullptr,
+      MPC::Model model = MPC::kCartesian, LapPlans* plans = nullptr,
+      Controller::Backend backend = Controller::kIpopt,
+      std::shared_ptr<const MPCConfig> config = MPCConfig::Default(),
+      const LiveWeights* live_weights = nullptr);
+
+  // Process one websocket message. Returns true if a reply was produced;
+  // it stays available through reply_data()/reply_length() until the next
+  // call.
+  bool HandleMessage(const char* data, size_t length);
+
+  const char* reply_data() const { return writer_.data(); }
+  size_t reply_length() const { return writer_.length(); }
+
+  // Whether the last message was a telemetry frame that went through the
+  // whole pipeline; only then are last_times() meaningful.
+  bool handled_telemetry() const { return handled_telemetry_; }
+  const StageTimes& last_times() const { return times_; }
+  // The last frame's solution, over the whole horizon, and its stats
+  const ControlResult& last_result() const { return result_; }
+  // Whether the last frame was the first solved with new weights
+  bool first_after_reload() const { return first_after_reload_; }
+
+ private:
+  typedef std::chrono::steady_clock Clock;
+
+  void HandleTelemetry(const nlohmann::json& telemetry, Clock::time_point start);
+
+  const bool verbose_;
+  const SplineTrack* const track_;
+  const MPC::Model model_;
+  LapPlans* const plans_;
+  // The car's last position on the track map
+  TrackProjection projection_;
+  bool has_projection_;
+  const std::shared_ptr<const MPCConfig> config_;
+  std::unique_ptr<Controller> controller_;
+  const LiveWeights* const live_weights_;
+  // The weights the last frame was solved with, held for the whole frame
+  // so a reload can't change them halfway
+  std::shared_ptr<const MPCWeights> weights_;
+  bool first_after_reload_;
+  ControlResult result_;
+  SteerWriter writer_;
+  // Waypoints of the current frame, in the car's coordinates once
+  // transformed
+  std::vector<double> waypoints_x_;
+  std::vector<double> waypoints_y_;
+  // Reference curvature at each step of the horizon, for the Frenet model
+  std::vector<double> curvature_;
+  // The solver's starting plan, and the arc length the last converged one
+  // was solved at
+  std::vector<double> start_plan_;
+  double plan_s_;
+  StageTimes times_;
+  bool handled_telemetry_;
+  // Messages handled so far
+  uint64_t messages_;
+};
+
+#endif /* SESSION_H */
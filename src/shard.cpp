@@ -0,0 +1,402 @@
+#include "shard.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <exception>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "latency_histogram.h"
+#include "metrics.h"
+#include "profiler.h"
+#include "session.h"
+#include "trace.h"
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+// Longest a recorded frame waits in the recorder's buffer before its block
+// is written out anyway
+const uint64_t kRecorderFlushMs = 1000;
+
+// Shards whose hub loop is running, for CloseRecorders
+std::mutex running_mutex;
+std::vector<Shard *> running_shards;
+
+void RecordSessionStages(const StageTimes &t) {
+  RecordStageSeconds(kStageFrame, t.frame);
+  RecordStageSeconds(kStageParse, t.parse);
+  RecordStageSeconds(kStageTransform, t.transform);
+  RecordStageSeconds(kStageFit, t.fit);
+  RecordStageSeconds(kStagePredict, t.predict);
+  RecordStageSeconds(kStageSolve, t.solve);
+  RecordStageSeconds(kStageSerialize, t.serialize);
+}
+
+}  // namespace
+
+struct Shard::Connection {
+  Connection(uWS::WebSocket<uWS::SERVER> ws, uint32_t id,
+             const ServerOptions& options, const SplineTrack* track,
+             LapPlans* plans, const LiveWeights* weights)
+      : ws(ws),
+        id(id),
+        session(options.verbose, track, options.model, plans,
+                options.controller, MPCConfig::Default(), weights) {
+    CountSessionOpened();
+  }
+  ~Connection() { CountSessionClosed(); }
+
+  uWS::WebSocket<uWS::SERVER> ws;
+  const uint32_t id;
+  Session session;
+
+  // Hub thread only; numbers messages for the tracer
+  uint64_t messages = 0;
+
+  // Guarded by Shard::mutex_
+  // Newest frame not yet handed to the solver
+  std::string pending;
+  bool has_pending = false;
+  Clock::time_point pending_at;
+  uint64_t pending_message = 0;
+  // Queued, solving or waiting to be sent
+  bool in_flight = false;
+  bool closed = false;
+
+  // Owned by whoever holds the connection in flight
+  std::string frame;
+  Clock::time_point frame_at;
+  uint64_t frame_message = 0;
+  Clock::time_point solved_at;
+  bool has_reply = false;
+  uint64_t send_at = 0;
+};
+
+Shard::Shard(const ServerOptions& options, size_t index,
+             const SplineTrack* track, const LiveWeights* weights)
+    : options_(options),
+      index_(index),
+      track_(track),
+      weights_(weights),
+      plans_(track != nullptr ? new LapPlans(track->length()) : nullptr),
+      next_connection_id_(0),
+      recorder_closed_(false),
+      stopping_(false) {
+  hub_.onMessage([this](uWS::WebSocket<uWS::SERVER> ws, char *data,
+                        size_t length, uWS::OpCode opCode) {
+    OnMessage(static_cast<Connection *>(ws.getUserData()), data, length);
+  });
+
+  // Besides the websocket upgrade the hub answers a few plain HTTP paths:
+  // /metrics for scraping, /healthz for liveness probes.
+  hub_.onHttpRequest([this](uWS::HttpResponse *res, uWS::HttpRequest req,
+                            char *data, size_t, size_t) {
+    uWS::Header url = req.getUrl();
+    std::string path(url.value, url.valueLength);
+    path = path.substr(0, path.find('?'));
+    std::string body;
+    if (path == "/") {
+      body = "<h1>Hello world!</h1>";
+    } else if (path == "/metrics") {
+      body = RenderMetrics();
+    } else if (path == "/healthz") {
+      body = Health();
+    } else if (path == "/profile/start") {
+      std::string error;
+      body = StartProfiler(&error) ? "profiling\n" : error + "\n";
+    } else if (path == "/profile/stop") {
+      // Symbolizing holds up this hub for a few milliseconds
+      body = StopProfiler();
+    }
+    res->end(body.data(), body.length());
+  });
+
+  hub_.onConnection([this](uWS::WebSocket<uWS::SERVER> ws,
+                           uWS::HttpRequest req) {
+    ws.setUserData(new Connection(ws, next_connection_id_++, options_, track_,
+                                  plans_.get(), weights_));
+    std::cout << "Connected!!!" << std::endl;
+  });
+
+  hub_.onDisconnection([this](uWS::WebSocket<uWS::SERVER> ws, int code,
+                              char *message, size_t length) {
+    OnDisconnection(static_cast<Connection *>(ws.getUserData()));
+    ws.setUserData(nullptr);
+    ws.close();
+    std::cout << "Disconnected" << std::endl;
+  });
+}
+
+Shard::~Shard() {
+  {
+    std::lock_guard<std::mutex> lock(running_mutex);
+    running_shards.erase(
+        std::remove(running_shards.begin(), running_shards.end(), this),
+        running_shards.end());
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  ready_cv_.notify_one();
+  if (solver_.joinable()) {
+    solver_.join();
+  }
+}
+
+bool Shard::Run() {
+  SetTraceThreadName("shard " + std::to_string(index_) + " hub");
+  uv_loop_t *loop = reinterpret_cast<uv_loop_t *>(hub_.getLoop());
+  uv_async_init(loop, &solved_async_, OnSolved);
+  solved_async_.data = this;
+  uv_timer_init(loop, &send_timer_);
+  send_timer_.data = this;
+  uv_timer_init(loop, &flush_timer_);
+  flush_timer_.data = this;
+  uv_async_init(loop, &close_async_, OnCloseRecorder);
+  close_async_.data = this;
+
+  if (!options_.record_path.empty()) {
+    const std::string path =
+        options_.record_path + "." + std::to_string(index_);
+    if (!recorder_.Open(path)) {
+      std::cerr << "Failed to open " << path << std::endl;
+      return false;
+    }
+    uv_timer_start(&flush_timer_, OnFlushTimer, kRecorderFlushMs,
+                   kRecorderFlushMs);
+  }
+
+  if (!hub_.listen(options_.port, nullptr, uS::ListenOptions::REUSE_PORT)) {
+    return false;
+  }
+  solver_ = std::thread(&Shard::SolverLoop, this);
+  {
+    std::lock_guard<std::mutex> lock(running_mutex);
+    running_shards.push_back(this);
+  }
+  hub_.run();
+  return true;
+}
+
+void Shard::CloseRecorders(std::chrono::milliseconds timeout) {
+  std::lock_guard<std::mutex> running_lock(running_mutex);
+  for (Shard *shard : running_shards) {
+    uv_async_send(&shard->close_async_);
+  }
+  const Clock::time_point deadline = Clock::now() + timeout;
+  for (Shard *shard : running_shards) {
+    std::unique_lock<std::mutex> lock(shard->mutex_);
+    if (!shard->closed_cv_.wait_until(
+            lock, deadline, [shard] { return shard->recorder_closed_; })) {
+      std::cerr << "Shard " << shard->index_
+                << " did not close its flight log in time" << std::endl;
+    }
+  }
+}
+
+void Shard::OnMessage(Connection *c, const char *data, size_t length) {
+  if (c == nullptr) {
+    return;
+  }
+  const uint64_t message = ++c->messages;
+  TraceScope scope(c->id, message);
+  StageTimer timer(kStageReceive);
+  Clock::time_point now = Clock::now();
+  recorder_.Record(c->id, data, length);
+  CountFrameReceived();
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (c->has_pending) {
+      CountFrameCoalesced();
+    }
+    c->pending.assign(data, length);
+    c->has_pending = true;
+    c->pending_at = now;
+    c->pending_message = message;
+    if (c->in_flight) {
+      // Coalesced: the solver picks up the newest frame once the current
+      // reply is out
+      return;
+    }
+    c->in_flight = true;
+    ready_.push_back(c);
+  }
+  ready_cv_.notify_one();
+}
+
+void Shard::OnDisconnection(Connection *c) {
+  if (c == nullptr) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  c->closed = true;
+  // A connection in flight is freed by the hub thread when it comes back
+  if (!c->in_flight) {
+    delete c;
+  }
+}
+
+void Shard::SolverLoop() {
+  SetTraceThreadName("shard " + std::to_string(index_) + " solver");
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (true) {
+    ready_cv_.wait(lock, [this] { return stopping_ || !ready_.empty(); });
+    if (stopping_) {
+      return;
+    }
+    Connection *c = ready_.front();
+    ready_.pop_front();
+    bool closed = c->closed;
+    if (!closed) {
+      c->frame.swap(c->pending);
+      c->frame_at = c->pending_at;
+      c->frame_message = c->pending_message;
+      c->has_pending = false;
+    }
+    lock.unlock();
+
+    c->has_reply = false;
+    if (!closed) {
+      TraceScope scope(c->id, c->frame_message);
+      RecordStageSpan(kStageQueue, c->frame_at, Clock::now());
+      try {
+        c->has_reply =
+            c->session.HandleMessage(c->frame.data(), c->frame.size());
+      } catch (const std::exception &e) {
+        // Malformed JSON or missing telemetry fields; skip the frame
+        CountFrameDropped();
+        std::cerr << "Dropped frame: " << e.what() << std::endl;
+      }
+      c->solved_at = Clock::now();
+      if (c->session.handled_telemetry()) {
+        RecordSessionStages(c->session.last_times());
+        RecordSolve(c->session.last_result().stats);
+        if (c->session.first_after_reload()) {
+          RecordFirstSolveAfterReload(c->session.last_result().stats.seconds);
+        }
+      }
+    }
+
+    lock.lock();
+    solved_.push_back(c);
+    uv_async_send(&solved_async_);
+  }
+}
+
+void Shard::OnSolved(uv_async_t *handle) {
+  static_cast<Shard *>(handle->data)->DeliverSolved();
+}
+
+void Shard::OnSendTimer(uv_timer_t *handle) {
+  static_cast<Shard *>(handle->data)->SendDue();
+}
+
+void Shard::OnFlushTimer(uv_timer_t *handle) {
+  static_cast<Shard *>(handle->data)->recorder_.Flush();
+}
+
+void Shard::OnCloseRecorder(uv_async_t *handle) {
+  Shard *shard = static_cast<Shard *>(handle->data);
+  uv_timer_stop(&shard->flush_timer_);
+  // Frames arriving from here on are no longer recorded
+  shard->recorder_.Close();
+  {
+    std::lock_guard<std::mutex> lock(shard->mutex_);
+    shard->recorder_closed_ = true;
+  }
+  shard->closed_cv_.notify_all();
+}
+
+void Shard::DeliverSolved() {
+  std::deque<Connection *> solved;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    solved.swap(solved_);
+  }
+
+  // Latency
+  // The purpose is to mimic real driving conditions where
+  // the car does actuate the commands instantly.
+  //
+  // Feel free to play around with this value but should be to drive
+  // around the track with 100ms latency.
+  //
+  // NOTE: REMEMBER TO SET THIS TO 100 MILLISECONDS BEFORE
+  // SUBMITTING.
+  const uint64_t now = uv_now(reinterpret_cast<uv_loop_t *>(hub_.getLoop()));
+  for (Connection *c : solved) {
+    if (c->has_reply) {
+      c->send_at = now + options_.latency_ms;
+      outbox_.push_back(c);
+    } else {
+      FinishFlight(c);
+    }
+  }
+  SendDue();
+}
+
+void Shard::SendDue() {
+  const uint64_t now = uv_now(reinterpret_cast<uv_loop_t *>(hub_.getLoop()));
+  while (!outbox_.empty() && outbox_.front()->send_at <= now) {
+    Connection *c = outbox_.front();
+    outbox_.pop_front();
+    if (!c->closed) {
+      TraceScope scope(c->id, c->frame_message);
+      RecordStageSpan(kStageActuation, c->solved_at, Clock::now());
+      StageTimer timer(kStageSend);
+      c->ws.send(c->session.reply_data(), c->session.reply_length(),
+                 uWS::OpCode::TEXT);
+      CountReplySent();
+    }
+    FinishFlight(c);
+  }
+  ArmSendTimer();
+}
+
+void Shard::FinishFlight(Connection *c) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (c->closed) {
+      delete c;
+      return;
+    }
+    if (!c->has_pending) {
+      c->in_flight = false;
+      return;
+    }
+    ready_.push_back(c);
+  }
+  ready_cv_.notify_one();
+}
+
+void Shard::ArmSendTimer() {
+  uv_timer_stop(&send_timer_);
+  if (outbox_.empty()) {
+    return;
+  }
+  const uint64_t now = uv_now(reinterpret_cast<uv_loop_t *>(hub_.getLoop()));
+  const uint64_t due = outbox_.front()->send_at;
+  uv_timer_start(&send_timer_, OnSendTimer, due > now ? due - now : 0, 0);
+}
+
+std::string Shard::Health() {
+  // The hub thread is answering; check the solver thread keeps up
+  const double kStalledSeconds = 2.0;
+  double waited = 0;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!ready_.empty()) {
+      waited = std::chrono::duration<double>(Clock::now() -
+                                             ready_.front()->pending_at)
+                   .count();
+    }
+  }
+  if (waited > kStalledSeconds) {
+    return "stalled: shard " + std::to_string(index_) +
+           " has had a frame queued for " + std::to_string(waited) + " s\n";
+  }
+  return "ok\n";
+}
@@ -0,0 +1,96 @@
+#ifndef SHARD_H
+#define SHARD_H
+
+#include <uWS/uWS.h>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include "flight_recorder.h"
+#include "lap_plans.h"
+#include "live_weights.h"
+#include "server_options.h"
+#include "spline_track.h"
+
+// One slice of the server: a uWS hub with its own event loop, plus a solver
+// thread that runs the sessions of the hub's connections.
+//
+// All shards listen on the same port with SO_REUSEPORT and the kernel
+// spreads connections across them. Each connection owns a Session and has
+// at most one frame in flight (queued, solving or waiting out the actuator
+// latency). Frames arriving meanwhile are coalesced: only the newest is kept
+// and solved next.
+class Shard {
+ public:
+  // `track`, if not null, is the map every session takes its reference from,
+  // and the shard keeps converged plans around it for its sessions.
+  // `weights`, if not null, are the cost weights its sessions solve with.
+  Shard(const ServerOptions& options, size_t index,
+        const SplineTrack* track, const LiveWeights* weights = nullptr);
+  ~Shard();
+
+  // Listen and serve until the hub's loop exits. Call from the thread that
+  // owns this shard.
+  bool Run();
+
+  // Have every running shard close its flight log on its own hub thread,
+  // writing out the buffered frames and the seek index, and wait until
+  // they have or `timeout` passes. For shutdown: call once, from any
+  // thread, right before the process exits.
+  static void CloseRecorders(std::chrono::milliseconds timeout);
+
+ private:
+  struct Connection;
+
+  // Hub thread
+  void OnMessage(Connection* c, const char* data, size_t length);
+  void OnDisconnection(Connection* c);
+  void DeliverSolved();
+  void SendDue();
+  void FinishFlight(Connection* c);
+  void ArmSendTimer();
+  // Body of /healthz: "ok" unless this shard's solver has fallen behind
+  std::string Health();
+  static void OnSolved(uv_async_t* handle);
+  static void OnSendTimer(uv_timer_t* handle);
+  static void OnFlushTimer(uv_timer_t* handle);
+  static void OnCloseRecorder(uv_async_t* handle);
+
+  // Solver thread
+  void SolverLoop();
+
+  const ServerOptions& options_;
+  const size_t index_;
+  const SplineTrack* const track_;
+  const LiveWeights* const weights_;
+  // Solver thread only, with a track
+  std::unique_ptr<LapPlans> plans_;
+  uWS::Hub hub_;
+  uv_async_t solved_async_;
+  uv_timer_t send_timer_;
+  // Writes the recorder's partial block out every kRecorderFlushMs
+  uv_timer_t flush_timer_;
+  uv_async_t close_async_;
+  // Hub thread only
+  uint32_t next_connection_id_;
+  FlightRecorder recorder_;
+
+  std::mutex mutex_;
+  std::condition_variable ready_cv_;
+  // Signaled once the hub thread has closed the recorder
+  std::condition_variable closed_cv_;
+  bool recorder_closed_;
+  // Connections with a frame for the solver
+  std::deque<Connection*> ready_;
+  // Connections the solver is done with, picked up by the hub thread
+  std::deque<Connection*> solved_;
+  // Replies waiting out the actuator latency, in send order (hub thread only)
+  std::deque<Connection*> outbox_;
+  bool stopping_;
+  std::thread solver_;
+};
+
+#endif /* SHARD_H */
@@ -0,0 +1,364 @@
+// Headless stand-in for the Unity simulator.
+//
+// Drives a kinematic bicycle model around a waypoint track and talks to
+// `mpc` over a local websocket using the same Socket.IO frames as the real
+// simulator (see DATA.md): it sends "telemetry", applies the "steer" reply
+// after a configurable actuator latency and sends the next telemetry frame.
+// A frame the server drops gets no reply; after --reply-timeout-ms of wall
+// time without one the frame is sent again, and the run fails once
+// kMaxResends in a row went unanswered. At the end it reports lap times,
+// tracking error and loop latency.
+//
+// Usage: mpc_sim [--url=ws://127.0.0.1:4567] [--track=lake_track_waypoints.csv]
+//                [--laps=N] [--latency-ms=N] [--waypoints=N] [--max-offset=M]
+//                [--timeout-s=N] [--reply-timeout-ms=N]
+
+#include <math.h>
+#include <uWS/uWS.h>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+#include "json.hpp"
+#include "sample_stats.h"
+#include "track.h"
+
+// for convenience
+using json = nlohmann::json;
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+// Same front axle to center of gravity length as the controller's model
+const double Lf = 2.67;
+const double kMaxSteer = 25 * M_PI / 180;
+// Acceleration at full throttle and quadratic drag, in SI units; gives a
+// top speed of about 110 mph
+const double kMaxAccel = 5.0;
+const double kDrag = 0.002;
+const double kMetersPerSecondPerMph = 0.44704;
+// Integration step of the vehicle model
+const double kStep = 0.005;
+// How often the wall-clock timer checks for a missing reply and for the
+// end of the run, and how many unanswered frames in a row fail it
+const uint64_t kWatchdogMs = 100;
+const int kMaxResends = 5;
+
+struct SimOptions {
+  std::string url = "ws://127.0.0.1:4567";
+  std::string track = "../lake_track_waypoints.csv";
+  int laps = 1;
+  int latency_ms = 0;
+  size_t waypoints = 6;
+  double max_offset = 8.0;
+  double timeout_s = 600;
+  int reply_timeout_ms = 2000;
+};
+
+bool ParseSimOptions(int argc, char* argv[], SimOptions* options) {
+  for (int i = 1; i < argc; ++i) {
+    const char* arg = argv[i];
+    const char* eq = strchr(arg, '=');
+    std::string name = eq ? std::string(arg, eq - arg) : std::string(arg);
+    const char* value = eq ? eq + 1 : "";
+    if (name == "--url") {
+      options->url = value;
+    } else if (name == "--track") {
+      options->track = value;
+    } else if (name == "--laps") {
+      options->laps = atoi(value);
+    } else if (name == "--latency-ms") {
+      options->latency_ms = atoi(value);
+    } else if (name == "--waypoints") {
+      options->waypoints = static_cast<size_t>(atoi(value));
+    } else if (name == "--max-offset") {
+      options->max_offset = atof(value);
+    } else if (name == "--timeout-s") {
+      options->timeout_s = atof(value);
+    } else if (name == "--reply-timeout-ms") {
+      options->reply_timeout_ms = atoi(value);
+    } else {
+      std::cerr << "Usage: " << argv[0]
+                << " [--url=U] [--track=CSV] [--laps=N] [--latency-ms=N]"
+                   " [--waypoints=N] [--max-offset=M] [--timeout-s=N]"
+                   " [--reply-timeout-ms=N]"
+                << std::endl;
+      return false;
+    }
+  }
+  return options->laps > 0 && options->waypoints >= 4 &&
+         options->latency_ms >= 0;
+}
+
+// Kinematic bicycle model driven around a Track.
+class Simulator {
+ public:
+  Simulator(const Track& track, const SimOptions& options)
+      : track_(track), options_(options), time_(0), x_(track.x()[0]),
+        y_(track.y()[0]), v_(0), delta_(0), throttle_(0), progress_(0),
+        lap_start_(0) {
+    psi_ = atan2(track.y()[1] - track.y()[0], track.x()[1] - track.x()[0]);
+    last_ = track.Project(x_, y_);
+  }
+
+  // Socket.IO telemetry frame for the current state.
+  std::string Telemetry() const {
+    // Waypoints from the one behind the car onwards, in global coordinates
+    std::vector<double> ptsx, ptsy;
+    for (size_t i = 0; i < options_.waypoints; ++i) {
+      size_t w = (last_.segment + i) % track_.size();
+      ptsx.push_back(track_.x()[w]);
+      ptsy.push_back(track_.y()[w]);
+    }
+    double psi = fmod(psi_, 2 * M_PI);
+    if (psi < 0) {
+      psi += 2 * M_PI;
+    }
+    double psi_unity = fmod(2.5 * M_PI - psi, 2 * M_PI);
+
+    json telemetry;
+    telemetry["ptsx"] = ptsx;
+    telemetry["ptsy"] = ptsy;
+    telemetry["x"] = x_;
+    telemetry["y"] = y_;
+    telemetry["psi"] = psi;
+    telemetry["psi_unity"] = psi_unity;
+    telemetry["speed"] = v_ / kMetersPerSecondPerMph;
+    telemetry["steering_angle"] = delta_;
+    telemetry["throttle"] = throttle_;
+    return "42[\"telemetry\"," + telemetry.dump() + "]";
+  }
+
+  // Queue a command; it takes effect after the actuator latency.
+  void Command(double steering, double throttle) {
+    Pending p;
+    p.at = time_ + options_.latency_ms / 1000.0;
+    p.delta = fmax(-1.0, fmin(1.0, steering)) * kMaxSteer;
+    p.throttle = fmax(-1.0, fmin(1.0, throttle));
+    pending_.push_back(p);
+  }
+
+  // Integrate the model forward by `seconds` of simulated time.
+  void Advance(double seconds) {
+    double end = time_ + seconds;
+    while (time_ < end) {
+      while (!pending_.empty() && pending_.front().at <= time_) {
+        delta_ = pending_.front().delta;
+        throttle_ = pending_.front().throttle;
+        pending_.pop_front();
+      }
+      double dt = fmin(kStep, end - time_);
+      x_ += v_ * cos(psi_) * dt;
+      y_ += v_ * sin(psi_) * dt;
+      // Positive steering turns right, as in the Unity simulator
+      psi_ -= v_ / Lf * delta_ * dt;
+      v_ = fmax(0.0, v_ + (throttle_ * kMaxAccel - kDrag * v_ * v_) * dt);
+      time_ += dt;
+      Follow();
+    }
+  }
+
+  double time() const { return time_; }
+  double offset() const { return last_.offset; }
+  int laps() const { return static_cast<int>(lap_times_.size()); }
+  const std::vector<double>& lap_times() const { return lap_times_; }
+  std::vector<double>* offsets() { return &offsets_; }
+  double top_speed_mph() const { return top_speed_ / kMetersPerSecondPerMph; }
+
+ private:
+  struct Pending {
+    double at;
+    double delta;
+    double throttle;
+  };
+
+  // Follow the car along the track, counting laps and tracking error.
+  void Follow() {
+    TrackProjection p = track_.Project(x_, y_, last_);
+    double ds = p.s - last_.s;
+    // Crossing waypoint 0 in either direction
+    if (ds < -track_.length() / 2) {
+      ds += track_.length();
+    } else if (ds > track_.length() / 2) {
+      ds -= track_.length();
+    }
+    progress_ += ds;
+    last_ = p;
+    offsets_.push_back(fabs(p.offset));
+    top_speed_ = fmax(top_speed_, v_);
+
+    if (progress_ >= track_.length() * (laps() + 1)) {
+      lap_times_.push_back(time_ - lap_start_);
+      lap_start_ = time_;
+    }
+  }
+
+  const Track& track_;
+  const SimOptions& options_;
+  double time_;
+  double x_, y_, psi_, v_;
+  double delta_, throttle_;
+  std::deque<Pending> pending_;
+  TrackProjection last_;
+  double progress_;
+  double lap_start_;
+  double top_speed_ = 0;
+  std::vector<double> lap_times_;
+  std::vector<double> offsets_;
+};
+
+void PrintReport(Simulator* sim, std::vector<double>* loop_seconds,
+                 int resends, const std::string& outcome) {
+  std::cout << "outcome: " << outcome << std::endl;
+  std::cout << std::fixed << std::setprecision(3);
+  std::cout << "simulated time: " << sim->time() << " s, top speed "
+            << sim->top_speed_mph() << " mph" << std::endl;
+  for (size_t i = 0; i < sim->lap_times().size(); ++i) {
+    std::cout << "lap " << i + 1 << ": " << sim->lap_times()[i] << " s"
+              << std::endl;
+  }
+
+  std::vector<double>* offsets = sim->offsets();
+  double sum2 = 0;
+  for (double d : *offsets) {
+    sum2 += d * d;
+  }
+  double rms = offsets->empty() ? 0 : sqrt(sum2 / offsets->size());
+  SampleSummary e = Summarize(offsets);
+  std::cout << "tracking error m: mean " << e.mean << " rms " << rms
+            << " p99 " << e.p99 << " max " << e.max << std::endl;
+
+  SampleSummary l = Summarize(loop_seconds);
+  std::cout << "loop latency ms (" << l.count << " replies): p50 "
+            << l.median * 1e3 << " p90 " << l.p90 * 1e3 << " p99 "
+            << l.p99 * 1e3 << " max " << l.max * 1e3 << std::endl;
+  std::cout << "frames resent after no reply: " << resends << std::endl;
+}
+
+void OnWatchdog(uv_timer_t* handle) {
+  (*static_cast<std::function<void()>*>(handle->data))();
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  SimOptions options;
+  if (!ParseSimOptions(argc, argv, &options)) {
+    return -1;
+  }
+  Track track;
+  if (!track.LoadCsv(options.track)) {
+    std::cerr << "Failed to load track " << options.track << std::endl;
+    return -1;
+  }
+
+  Simulator sim(track, options);
+  std::vector<double> loop_seconds;
+  Clock::time_point sent_at;
+  Clock::time_point stepped_at;
+  // The server's connection, once open, and frames sent again in a row
+  // for lack of a reply, and in total
+  std::unique_ptr<uWS::WebSocket<uWS::CLIENT>> server;
+  int unanswered = 0;
+  int resends = 0;
+
+  uWS::Hub h;
+
+  // The model runs in step with the wall clock, so solver time and latency
+  // show up on the track just as with the real simulator. Ends the run if
+  // it is over.
+  auto advance = [&](Clock::time_point now) {
+    sim.Advance(std::chrono::duration<double>(now - stepped_at).count());
+    stepped_at = now;
+
+    std::string outcome;
+    int code = 0;
+    if (fabs(sim.offset()) > options.max_offset) {
+      outcome = "left the track";
+      code = 1;
+    } else if (sim.laps() >= options.laps) {
+      outcome = "completed " + std::to_string(sim.laps()) + " lap(s)";
+    } else if (sim.time() > options.timeout_s) {
+      outcome = "timed out";
+      code = 1;
+    } else if (unanswered > kMaxResends) {
+      outcome = "no reply to " + std::to_string(unanswered) + " frames";
+      code = 1;
+    }
+    if (!outcome.empty()) {
+      PrintReport(&sim, &loop_seconds, resends, outcome);
+      server->close();
+      exit(code);
+    }
+  };
+
+  auto send_telemetry = [&]() {
+    std::string msg = sim.Telemetry();
+    sent_at = Clock::now();
+    server->send(msg.data(), msg.length(), uWS::OpCode::TEXT);
+  };
+
+  h.onConnection([&](uWS::WebSocket<uWS::CLIENT> ws, uWS::HttpRequest req) {
+    std::cout << "Connected to " << options.url << std::endl;
+    server.reset(new uWS::WebSocket<uWS::CLIENT>(ws));
+    stepped_at = Clock::now();
+    send_telemetry();
+  });
+
+  h.onMessage([&](uWS::WebSocket<uWS::CLIENT> ws, char *data, size_t length,
+                  uWS::OpCode opCode) {
+    Clock::time_point now = Clock::now();
+    std::string sdata(data, length);
+    if (sdata.compare(0, 10, "42[\"steer\"") == 0) {
+      loop_seconds.push_back(
+          std::chrono::duration<double>(now - sent_at).count());
+      auto j = json::parse(sdata.substr(2));
+      sim.Command(j[1]["steering_angle"], j[1]["throttle"]);
+    }
+    unanswered = 0;
+    advance(now);
+    send_telemetry();
+  });
+
+  // Wall-clock watchdog: the loop above only turns on replies, so a frame
+  // the server dropped would stall it, --timeout-s included
+  std::function<void()> watchdog = [&]() {
+    if (server == nullptr) {
+      return;
+    }
+    const Clock::time_point now = Clock::now();
+    if (now - sent_at < std::chrono::milliseconds(options.reply_timeout_ms)) {
+      advance(now);
+      return;
+    }
+    ++unanswered;
+    advance(now);
+    ++resends;
+    send_telemetry();
+  };
+  uv_timer_t watchdog_timer;
+  uv_timer_init(reinterpret_cast<uv_loop_t *>(h.getLoop()), &watchdog_timer);
+  watchdog_timer.data = &watchdog;
+  uv_timer_start(&watchdog_timer, OnWatchdog, kWatchdogMs, kWatchdogMs);
+
+  h.onDisconnection([&](uWS::WebSocket<uWS::CLIENT> ws, int code,
+                        char *message, size_t length) {
+    PrintReport(&sim, &loop_seconds, resends, "disconnected");
+    exit(1);
+  });
+
+  h.onError([&](void *user) {
+    std::cerr << "Failed to connect to " << options.url << std::endl;
+    exit(-1);
+  });
+
+  h.connect(options.url, nullptr);
+  h.run();
+}
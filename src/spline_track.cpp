@@ -0,0 +1,236 @@
+#include "spline_track.h"
+#include <math.h>
+#include <algorithm>
+#include "Eigen-3.3/Eigen/Core"
+#include "Eigen-3.3/unsupported/Eigen/Splines"
+
+namespace {
+
+typedef Eigen::Spline<double, 2> Spline2d;
+
+// Waypoints repeated on each side of the lap, so the interpolating spline
+// is as smooth where the lap closes as anywhere else
+const size_t kWrap = 3;
+// Integration steps per waypoint span when measuring arc length
+const int kArcSteps = 64;
+// Newton steps when projecting; two usually settle to well under 1e-6 m
+const int kMaxNewtonSteps = 6;
+
+}  // namespace
+
+constexpr double SplineTrack::kTableStep;
+
+SplineTrack::SplineTrack() : arrays_(), length_(0), inv_step_(0) {}
+
+SplineTrack::SplineTrack(const Arrays& arrays)
+    : waypoints_(arrays.waypoints), arrays_(arrays) {
+  SetScale();
+}
+
+SplineTrack::Arrays SplineTrack::arrays() const {
+  Arrays arrays = arrays_;
+  arrays.waypoints = waypoints_.arrays();
+  return arrays;
+}
+
+void SplineTrack::SetScale() {
+  length_ = arrays_.waypoint_s[waypoints_.size()];
+  inv_step_ = (arrays_.entries - 1) / length_;
+}
+
+void SplineTrack::Build(const Track& waypoints) {
+  waypoints_ = waypoints;
+  const size_t n = waypoints.size();
+  const size_t count = n + 2 * kWrap + 1;
+
+  // The loop with kWrap waypoints before it and kWrap + 1 after, the first
+  // of those closing it, parameterized by chord length
+  Eigen::Matrix2Xd points(2, count);
+  Eigen::RowVectorXd params(count);
+  for (size_t k = 0; k < count; ++k) {
+    const size_t i = (k + n - kWrap) % n;
+    points(0, k) = waypoints.x()[i];
+    points(1, k) = waypoints.y()[i];
+    params(k) = k == 0 ? 0.0
+                       : params(k - 1) +
+                             (points.col(k) - points.col(k - 1)).norm();
+  }
+  params /= params(count - 1);
+  const Spline2d spline =
+      Eigen::SplineFitting<Spline2d>::Interpolate(points, 3, params);
+
+  // Arc length at each of the loop's waypoints and at every integration
+  // step between them, by Simpson's rule on the speed |dP/du|
+  auto speed = [&spline](double u) {
+    return spline.derivatives(u, 1).col(1).matrix().norm();
+  };
+  std::vector<double> u_steps;
+  std::vector<double> s_steps;
+  u_steps.reserve(n * kArcSteps + 1);
+  s_steps.reserve(n * kArcSteps + 1);
+  waypoint_s_.assign(n + 1, 0.0);
+  double s = 0;
+  for (size_t i = 0; i < n; ++i) {
+    const double u0 = params(kWrap + i);
+    const double du = (params(kWrap + i + 1) - u0) / kArcSteps;
+    waypoint_s_[i] = s;
+    for (int k = 0; k < kArcSteps; ++k) {
+      const double u = u0 + k * du;
+      u_steps.push_back(u);
+      s_steps.push_back(s);
+      s += du / 6 * (speed(u) + 4 * speed(u + du / 2) + speed(u + du));
+    }
+  }
+  u_steps.push_back(params(kWrap + n));
+  s_steps.push_back(s);
+  waypoint_s_[n] = s;
+  const double length = s;
+
+  // Table entries at even arc lengths, each from the spline parameter found
+  // by interpolating between integration steps
+  const size_t steps = static_cast<size_t>(ceil(length / kTableStep));
+  const double step = length / steps;
+  table_.resize(steps + 1);
+  size_t k = 0;
+  for (size_t e = 0; e <= steps; ++e) {
+    const double target = e == steps ? length : e * step;
+    while (k + 2 < s_steps.size() && s_steps[k + 1] <= target) {
+      ++k;
+    }
+    const double t = (target - s_steps[k]) / (s_steps[k + 1] - s_steps[k]);
+    const double u = u_steps[k] + t * (u_steps[k + 1] - u_steps[k]);
+    const Eigen::Array2Xd d = spline.derivatives(u, 2);
+    const double dx = d(0, 1), dy = d(1, 1);
+    const double ddx = d(0, 2), ddy = d(1, 2);
+    SplinePoint& p = table_[e].point;
+    p.x = d(0, 0);
+    p.y = d(1, 0);
+    p.heading = atan2(dy, dx);
+    if (e > 0) {
+      // Continue from the previous entry instead of jumping at +-pi
+      const double previous = table_[e - 1].point.heading;
+      p.heading = previous + remainder(p.heading - previous, 2 * M_PI);
+    }
+    const double speed2 = dx * dx + dy * dy;
+    p.curvature = (dx * ddy - dy * ddx) / (speed2 * sqrt(speed2));
+    table_[e].tangent_x = dx / sqrt(speed2);
+    table_[e].tangent_y = dy / sqrt(speed2);
+  }
+  // The fit passes exactly through waypoint 0 at both ends of the loop;
+  // make the last entry its first again
+  table_.back().point.x = table_.front().point.x;
+  table_.back().point.y = table_.front().point.y;
+
+  knots_.assign(spline.knots().data(),
+                spline.knots().data() + spline.knots().size());
+  control_points_.assign(spline.ctrls().data(),
+                         spline.ctrls().data() + spline.ctrls().size());
+
+  arrays_.waypoints = waypoints_.arrays();
+  arrays_.waypoint_s = waypoint_s_.data();
+  arrays_.entries = table_.size();
+  arrays_.table = table_.data();
+  arrays_.knot_count = knots_.size();
+  arrays_.knots = knots_.data();
+  arrays_.control_point_count = spline.ctrls().cols();
+  arrays_.control_points = control_points_.data();
+  arrays_.lap_begin = params(kWrap);
+  arrays_.lap_end = params(kWrap + n);
+  SetScale();
+}
+
+SplineTrack::Entry SplineTrack::Interpolate(double s) const {
+  if (s < 0 || s >= length_) {
+    s -= floor(s / length_) * length_;
+  }
+  const double f = s * inv_step_;
+  const size_t i = std::min(static_cast<size_t>(f), arrays_.entries - 2);
+  const double t = f - i;
+  const Entry& a = arrays_.table[i];
+  const Entry& b = arrays_.table[i + 1];
+  Entry e;
+  e.point.x = a.point.x + t * (b.point.x - a.point.x);
+  e.point.y = a.point.y + t * (b.point.y - a.point.y);
+  e.point.heading = a.point.heading + t * (b.point.heading - a.point.heading);
+  e.point.curvature =
+      a.point.curvature + t * (b.point.curvature - a.point.curvature);
+  e.tangent_x = a.tangent_x + t * (b.tangent_x - a.tangent_x);
+  e.tangent_y = a.tangent_y + t * (b.tangent_y - a.tangent_y);
+  return e;
+}
+
+SplinePoint SplineTrack::At(double s) const {
+  SplinePoint p = Interpolate(s).point;
+  p.heading = remainder(p.heading, 2 * M_PI);
+  return p;
+}
+
+bool SplineTrack::Refine(double px, double py, double s,
+                         TrackProjection* projection) const {
+  double offset = 0;
+  for (int step = 0; step < kMaxNewtonSteps; ++step) {
+    const Entry e = Interpolate(s);
+    const double tx = e.tangent_x, ty = e.tangent_y;
+    const double dx = px - e.point.x, dy = py - e.point.y;
+    const double along = tx * dx + ty * dy;
+    offset = tx * dy - ty * dx;
+    // Along the curve the tangent turns, so a step of `along` on the
+    // offset line is a shorter one on the center line
+    const double scale = 1 - e.point.curvature * offset;
+    if (scale < 0.1) {
+      return false;
+    }
+    s += along / scale;
+    if (fabs(along) < 1e-6) {
+      break;
+    }
+  }
+  if (fabs(offset) > Track::kCellSize) {
+    return false;
+  }
+  s -= floor(s / length_) * length_;
+  projection->segment =
+      std::min(static_cast<size_t>(s * inv_step_), arrays_.entries - 2);
+  projection->s = s;
+  projection->offset = offset;
+  return true;
+}
+
+TrackProjection SplineTrack::Project(double px, double py) const {
+  // Start from the same fraction of the way along the closest waypoint
+  // segment
+  const TrackProjection coarse = waypoints_.Project(px, py);
+  const size_t i = coarse.segment;
+  const double t = (coarse.s - waypoints_.s(i)) /
+                   (waypoints_.s(i + 1) - waypoints_.s(i));
+  const double* waypoint_s = arrays_.waypoint_s;
+  double s = waypoint_s[i] + t * (waypoint_s[i + 1] - waypoint_s[i]);
+  TrackProjection projection;
+  if (Refine(px, py, s, &projection)) {
+    return projection;
+  }
+  // Far from the track: the closest point of the waypoint segment
+  projection.segment =
+      std::min(static_cast<size_t>(s * inv_step_), arrays_.entries - 2);
+  projection.s = s;
+  projection.offset = coarse.offset;
+  return projection;
+}
+
+TrackProjection SplineTrack::Project(double px, double py,
+                                     const TrackProjection& hint) const {
+  TrackProjection projection;
+  if (Refine(px, py, hint.s, &projection)) {
+    return projection;
+  }
+  return Project(px, py);
+}
+
+void SplineTrack::PointsAlong(double s, double spacing, size_t n, double* x,
+                              double* y) const {
+  for (size_t k = 0; k < n; ++k) {
+    const Entry e = Interpolate(s + k * spacing);
+    x[k] = e.point.x;
+    y[k] = e.point.y;
+  }
+}
@@ -0,0 +1,125 @@
+#ifndef SPLINE_TRACK_H
+#define SPLINE_TRACK_H
+
+#include <cstddef>
+#include <vector>
+#include "track.h"
+
+// The center line at one arc length.
+struct SplinePoint {
+  double x;
+  double y;
+  // Direction of travel, radians in (-pi, pi]
+  double heading;
+  // d heading / ds, 1/m; positive turning left
+  double curvature;
+};
+
+// A closed cubic spline through a Track's waypoints, parameterized by arc
+// length.
+//
+// Building fits the spline with Eigen's Splines module and samples it every
+// kTableStep meters of arc length into a table of position, heading and
+// curvature, all from the spline's analytic derivatives. Lookups interpolate
+// between two neighbouring entries of the table, so they cost the same
+// anywhere on the lap. Like Track, a built SplineTrack is never modified and
+// can be shared by any number of threads, and it either owns its arrays or
+// views those of a mapped track file.
+class SplineTrack {
+ public:
+  // Table spacing, in meters; linear interpolation between entries is then
+  // within about 1e-3 m of the spline on the lake track's sharpest turn
+  static constexpr double kTableStep = 0.25;
+
+  // A table entry, with the heading also as a unit vector for projecting
+  struct Entry {
+    SplinePoint point;
+    double tangent_x;
+    double tangent_y;
+  };
+
+  // Everything a spline track is made of, for writing it to a track file
+  // and viewing it from one.
+  struct Arrays {
+    Track::Arrays waypoints;
+    // Arc length of each waypoint, and the lap length after the last
+    const double* waypoint_s;
+    // Entry i is at arc length i * length / (entries - 1); the last repeats
+    // the first, with the heading continued past it rather than wrapped
+    size_t entries;
+    const Entry* table;
+    // The fitted B-spline, for evaluating it exactly: its knots, control
+    // points as x, y pairs, and the parameters where the lap starts and
+    // closes
+    size_t knot_count;
+    const double* knots;
+    size_t control_point_count;
+    const double* control_points;
+    double lap_begin;
+    double lap_end;
+  };
+
+  SplineTrack();
+  // A spline track viewing `arrays`, which must outlive it.
+  explicit SplineTrack(const Arrays& arrays);
+  // Not copied: a copy of one that owns its arrays would view the
+  // original's
+  SplineTrack(const SplineTrack&) = delete;
+  SplineTrack& operator=(const SplineTrack&) = delete;
+
+  // Fit the spline through `waypoints`, which has at least three. The
+  // waypoints are copied, for projecting without a hint.
+  void Build(const Track& waypoints);
+
+  // Lap length along the spline
+  double length() const { return length_; }
+  // Arc length of waypoint i on the spline
+  double waypoint_s(size_t i) const { return arrays_.waypoint_s[i]; }
+  const Track& waypoints() const { return waypoints_; }
+  // The arrays, with arrays().waypoints those of waypoints()
+  Arrays arrays() const;
+
+  // The center line at arc length `s`, wrapped around the lap.
+  SplinePoint At(double s) const;
+
+  // Project (px, py) onto the spline. In the result `segment` is the table
+  // entry just before the projected point.
+  TrackProjection Project(double px, double py) const;
+
+  // As Project(px, py), starting from `hint`, a projection of the previous
+  // position, instead of the closest waypoint segment.
+  TrackProjection Project(double px, double py,
+                          const TrackProjection& hint) const;
+
+  // `n` points every `spacing` meters along the spline, starting at arc
+  // length `s`.
+  void PointsAlong(double s, double spacing, size_t n, double* x,
+                   double* y) const;
+
+ private:
+  // Newton steps on the distance to (px, py) from arc length `s`. Returns
+  // false if they do not settle on a point within Track::kCellSize.
+  bool Refine(double px, double py, double s,
+              TrackProjection* projection) const;
+
+  // Entry at arc length `s`, interpolated; the heading is not wrapped
+  Entry Interpolate(double s) const;
+
+  // Derive the lap length and table step from arrays_.
+  void SetScale();
+
+  Track waypoints_;
+  // Views of the storage below or of a track file; waypoints are in
+  // waypoints_
+  Arrays arrays_;
+  double length_;
+  double inv_step_;
+
+  // Storage of a spline track that owns its arrays
+  std::vector<double> waypoint_s_;
+  std::vector<Entry> table_;
+  std::vector<double> knots_;
+  std::vector<double> control_points_;
+};
+
+#endif /* SPLINE_TRACK_H */
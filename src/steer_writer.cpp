@@ -0,0 +1,410 @@
+#include "steer_writer.h"
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+namespace {
+
+// Frame prefix, keys and suffix of the reply, in json.hpp's sorted key order.
+const char kPrefix[] = "42[\"steer\",{";
+const char kMpcX[] = "\"mpc_x\":[";
+const char kMpcY[] = "],\"mpc_y\":[";
+const char kNextX[] = "],\"next_x\":[";
+const char kNextY[] = "],\"next_y\":[";
+const char kSteering[] = "],\"steering_angle\":";
+const char kThrottle[] = ",\"throttle\":";
+const char kSuffix[] = "}]";
+const char kManual[] = "42[\"manual\",{}]";
+
+// Shortest round-trip formatting of doubles with Grisu2 (Loitsch, "Printing
+// floating-point numbers quickly and accurately with integers", PLDI 2010).
+// The digits always read back to the same double; in rare cases they are one
+// digit longer than strictly necessary. About ten times faster than finding
+// the shortest precision with snprintf and strtod.
+
+// Grisu2 never produces more digits than this for a double
+const int kMaxDigits = 17;
+
+// A floating point value f * 2^e with a 64-bit significand.
+struct DiyFp {
+  uint64_t f;
+  int e;
+};
+
+DiyFp Sub(DiyFp x, DiyFp y) { return DiyFp{x.f - y.f, x.e}; }
+
+// x * y rounded to the upper 64 bits of the product.
+DiyFp Mul(DiyFp x, DiyFp y) {
+  const uint64_t mask = 0xFFFFFFFFu;
+  const uint64_t x_lo = x.f & mask, x_hi = x.f >> 32;
+  const uint64_t y_lo = y.f & mask, y_hi = y.f >> 32;
+  const uint64_t p0 = x_lo * y_lo;
+  const uint64_t p1 = x_lo * y_hi;
+  const uint64_t p2 = x_hi * y_lo;
+  const uint64_t p3 = x_hi * y_hi;
+  uint64_t mid = (p0 >> 32) + (p1 & mask) + (p2 & mask);
+  mid += uint64_t(1) << 31;
+  return DiyFp{p3 + (p1 >> 32) + (p2 >> 32) + (mid >> 32), x.e + y.e + 64};
+}
+
+DiyFp Normalize(DiyFp x) {
+  while ((x.f >> 63) == 0) {
+    x.f <<= 1;
+    --x.e;
+  }
+  return x;
+}
+
+// The value v and the lower and upper boundaries of the interval of reals
+// that round to it, m_minus and m_plus sharing m_plus' normalized exponent.
+void Boundaries(double value, DiyFp* v, DiyFp* m_minus, DiyFp* m_plus) {
+  const int kBias = 1075;  // exponent bias + 52 fraction bits
+  const uint64_t kHidden = uint64_t(1) << 52;
+  uint64_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+  const uint64_t exponent = (bits >> 52) & 0x7FF;
+  const uint64_t fraction = bits & (kHidden - 1);
+  DiyFp w = exponent == 0
+                ? DiyFp{fraction, 1 - kBias}
+                : DiyFp{fraction + kHidden, static_cast<int>(exponent) - kBias};
+
+  // The lower boundary is closer when the value is a power of two
+  const bool lower_closer = fraction == 0 && exponent > 1;
+  DiyFp plus = Normalize(DiyFp{2 * w.f + 1, w.e - 1});
+  DiyFp minus = lower_closer ? DiyFp{4 * w.f - 1, w.e - 2}
+                             : DiyFp{2 * w.f - 1, w.e - 1};
+  minus.f <<= minus.e - plus.e;
+  minus.e = plus.e;
+
+  *v = Normalize(w);
+  *m_minus = minus;
+  *m_plus = plus;
+}
+
+struct CachedPower {
+  uint64_t f;
+  int e;
+  int k;
+};
+
+// Normalized approximations of 10^k for k = -300, -292, ..., 324.
+const CachedPower kCachedPowers[] = {
+    {0xAB70FE17C79AC6CA, -1060, -300},
+    {0xFF77B1FCBEBCDC4F, -1034, -292},
+    {0xBE5691EF416BD60C, -1007, -284},
+    {0x8DD01FAD907FFC3C, -980, -276},
+    {0xD3515C2831559A83, -954, -268},
+    {0x9D71AC8FADA6C9B5, -927, -260},
+    {0xEA9C227723EE8BCB, -901, -252},
+    {0xAECC49914078536D, -874, -244},
+    {0x823C12795DB6CE57, -847, -236},
+    {0xC21094364DFB5637, -821, -228},
+    {0x9096EA6F3848984F, -794, -220},
+    {0xD77485CB25823AC7, -768, -212},
+    {0xA086CFCD97BF97F4, -741, -204},
+    {0xEF340A98172AACE5, -715, -196},
+    {0xB23867FB2A35B28E, -688, -188},
+    {0x84C8D4DFD2C63F3B, -661, -180},
+    {0xC5DD44271AD3CDBA, -635, -172},
+    {0x936B9FCEBB25C996, -608, -164},
+    {0xDBAC6C247D62A584, -582, -156},
+    {0xA3AB66580D5FDAF6, -555, -148},
+    {0xF3E2F893DEC3F126, -529, -140},
+    {0xB5B5ADA8AAFF80B8, -502, -132},
+    {0x87625F056C7C4A8B, -475, -124},
+    {0xC9BCFF6034C13053, -449, -116},
+    {0x964E858C91BA2655, -422, -108},
+    {0xDFF9772470297EBD, -396, -100},
+    {0xA6DFBD9FB8E5B88F, -369, -92},
+    {0xF8A95FCF88747D94, -343, -84},
+    {0xB94470938FA89BCF, -316, -76},
+    {0x8A08F0F8BF0F156B, -289, -68},
+    {0xCDB02555653131B6, -263, -60},
+    {0x993FE2C6D07B7FAC, -236, -52},
+    {0xE45C10C42A2B3B06, -210, -44},
+    {0xAA242499697392D3, -183, -36},
+    {0xFD87B5F28300CA0E, -157, -28},
+    {0xBCE5086492111AEB, -130, -20},
+    {0x8CBCCC096F5088CC, -103, -12},
+    {0xD1B71758E219652C, -77, -4},
+    {0x9C40000000000000, -50, 4},
+    {0xE8D4A51000000000, -24, 12},
+    {0xAD78EBC5AC620000, 3, 20},
+    {0x813F3978F8940984, 30, 28},
+    {0xC097CE7BC90715B3, 56, 36},
+    {0x8F7E32CE7BEA5C70, 83, 44},
+    {0xD5D238A4ABE98068, 109, 52},
+    {0x9F4F2726179A2245, 136, 60},
+    {0xED63A231D4C4FB27, 162, 68},
+    {0xB0DE65388CC8ADA8, 189, 76},
+    {0x83C7088E1AAB65DB, 216, 84},
+    {0xC45D1DF942711D9A, 242, 92},
+    {0x924D692CA61BE758, 269, 100},
+    {0xDA01EE641A708DEA, 295, 108},
+    {0xA26DA3999AEF774A, 322, 116},
+    {0xF209787BB47D6B85, 348, 124},
+    {0xB454E4A179DD1877, 375, 132},
+    {0x865B86925B9BC5C2, 402, 140},
+    {0xC83553C5C8965D3D, 428, 148},
+    {0x952AB45CFA97A0B3, 455, 156},
+    {0xDE469FBD99A05FE3, 481, 164},
+    {0xA59BC234DB398C25, 508, 172},
+    {0xF6C69A72A3989F5C, 534, 180},
+    {0xB7DCBF5354E9BECE, 561, 188},
+    {0x88FCF317F22241E2, 588, 196},
+    {0xCC20CE9BD35C78A5, 614, 204},
+    {0x98165AF37B2153DF, 641, 212},
+    {0xE2A0B5DC971F303A, 667, 220},
+    {0xA8D9D1535CE3B396, 694, 228},
+    {0xFB9B7CD9A4A7443C, 720, 236},
+    {0xBB764C4CA7A44410, 747, 244},
+    {0x8BAB8EEFB6409C1A, 774, 252},
+    {0xD01FEF10A657842C, 800, 260},
+    {0x9B10A4E5E9913129, 827, 268},
+    {0xE7109BFBA19C0C9D, 853, 276},
+    {0xAC2820D9623BF429, 880, 284},
+    {0x80444B5E7AA7CF85, 907, 292},
+    {0xBF21E44003ACDD2D, 933, 300},
+    {0x8E679C2F5E44FF8F, 960, 308},
+    {0xD433179D9C8CB841, 986, 316},
+    {0x9E19DB92B4E31BA9, 1013, 324},
+};
+
+// Binary exponent range the scaled boundaries are brought into, so the
+// integral part of the upper boundary fits in 32 bits.
+const int kAlpha = -60;
+const int kGamma = -32;
+
+// The cached power c = 10^-k such that kAlpha <= c.e + e + 64 <= kGamma.
+CachedPower CachedPowerFor(int e) {
+  const int kMinDecimalExponent = -300;
+  const int kDecimalExponentStep = 8;
+  // ceil((kAlpha - e - 1) * log10(2))
+  const int f = kAlpha - e - 1;
+  const int k = (f * 78913) / (1 << 18) + (f > 0 ? 1 : 0);
+  const int index = (-kMinDecimalExponent + k + (kDecimalExponentStep - 1)) /
+                    kDecimalExponentStep;
+  return kCachedPowers[index];
+}
+
+// Move the last digit towards w while the result stays inside the interval.
+void RoundWeed(char* digits, int length, uint64_t distance, uint64_t delta,
+               uint64_t rest, uint64_t ten_k) {
+  while (rest < distance && delta - rest >= ten_k &&
+         (rest + ten_k < distance ||
+          distance - rest > rest + ten_k - distance)) {
+    --digits[length - 1];
+    rest += ten_k;
+  }
+}
+
+// Generate the digits of a value in (m_minus, m_plus), as close to w as
+// possible. The result is digits * 10^exponent.
+void DigitGen(char* digits, int* length, int* exponent, DiyFp m_minus,
+              DiyFp w, DiyFp m_plus) {
+  uint64_t delta = Sub(m_plus, m_minus).f;
+  uint64_t distance = Sub(m_plus, w).f;
+  const int shift = -m_plus.e;
+  const uint64_t one = uint64_t(1) << shift;
+  uint32_t p1 = static_cast<uint32_t>(m_plus.f >> shift);
+  uint64_t p2 = m_plus.f & (one - 1);
+
+  uint32_t pow10 = 1000000000;
+  int n = 10;
+  while (n > 1 && p1 < pow10) {
+    pow10 /= 10;
+    --n;
+  }
+
+  *length = 0;
+  while (n > 0) {
+    digits[(*length)++] = static_cast<char>('0' + p1 / pow10);
+    p1 %= pow10;
+    --n;
+    const uint64_t rest = (static_cast<uint64_t>(p1) << shift) + p2;
+    if (rest <= delta) {
+      *exponent += n;
+      RoundWeed(digits, *length, distance, delta, rest,
+                static_cast<uint64_t>(pow10) << shift);
+      return;
+    }
+    pow10 /= 10;
+  }
+
+  int m = 0;
+  while (true) {
+    p2 *= 10;
+    digits[(*length)++] = static_cast<char>('0' + (p2 >> shift));
+    p2 &= one - 1;
+    ++m;
+    delta *= 10;
+    distance *= 10;
+    if (p2 <= delta) {
+      break;
+    }
+  }
+  *exponent -= m;
+  RoundWeed(digits, *length, distance, delta, p2, one);
+}
+
+// Shortest digits of a finite, positive value; value = digits * 10^exponent.
+void Grisu2(double value, char* digits, int* length, int* exponent) {
+  DiyFp v, m_minus, m_plus;
+  Boundaries(value, &v, &m_minus, &m_plus);
+  const CachedPower cached = CachedPowerFor(m_plus.e);
+  const DiyFp c = {cached.f, cached.e};
+  const DiyFp w = Mul(v, c);
+  DiyFp lower = Mul(m_minus, c);
+  DiyFp upper = Mul(m_plus, c);
+  // Shrink the interval by one unit to absorb the multiplication error
+  ++lower.f;
+  --upper.f;
+  *exponent = -cached.k;
+  DigitGen(digits, length, exponent, lower, w, upper);
+}
+
+// Append `value` to `out` in exponent notation the way printf's %e does,
+// with a sign and at least two exponent digits. Returns the end of output.
+char* AppendExponent(char* out, int value) {
+  *out++ = 'e';
+  *out++ = value < 0 ? '-' : '+';
+  unsigned magnitude = value < 0 ? -value : value;
+  if (magnitude >= 100) {
+    *out++ = static_cast<char>('0' + magnitude / 100);
+    magnitude %= 100;
+  }
+  *out++ = static_cast<char>('0' + magnitude / 10);
+  *out++ = static_cast<char>('0' + magnitude % 10);
+  return out;
+}
+
+}  // namespace
+
+SteerWriter::SteerWriter(size_t capacity) : buffer_(capacity), length_(0) {}
+
+void SteerWriter::Write(double steering_angle, double throttle,
+                        DoubleSpan next_x, DoubleSpan next_y,
+                        DoubleSpan mpc_x, DoubleSpan mpc_y) {
+  length_ = 0;
+  const size_t numbers =
+      2 + next_x.size + next_y.size + mpc_x.size + mpc_y.size;
+  Reserve(sizeof(kPrefix) + sizeof(kMpcX) + sizeof(kMpcY) + sizeof(kNextX) +
+          sizeof(kNextY) + sizeof(kSteering) + sizeof(kThrottle) +
+          sizeof(kSuffix) + numbers * kMaxNumberLength);
+
+  Append(kPrefix, sizeof(kPrefix) - 1);
+  AppendArray(kMpcX, sizeof(kMpcX) - 1, mpc_x);
+  AppendArray(kMpcY, sizeof(kMpcY) - 1, mpc_y);
+  AppendArray(kNextX, sizeof(kNextX) - 1, next_x);
+  AppendArray(kNextY, sizeof(kNextY) - 1, next_y);
+  Append(kSteering, sizeof(kSteering) - 1);
+  AppendDouble(steering_angle);
+  Append(kThrottle, sizeof(kThrottle) - 1);
+  AppendDouble(throttle);
+  Append(kSuffix, sizeof(kSuffix) - 1);
+}
+
+void SteerWriter::WriteManual() {
+  length_ = 0;
+  Reserve(sizeof(kManual));
+  Append(kManual, sizeof(kManual) - 1);
+}
+
+void SteerWriter::Reserve(size_t bytes) {
+  if (buffer_.size() < bytes) {
+    buffer_.resize(bytes);
+  }
+}
+
+void SteerWriter::Append(const char* s, size_t n) {
+  memcpy(&buffer_[length_], s, n);
+  length_ += n;
+}
+
+void SteerWriter::AppendArray(const char* key, size_t key_length,
+                              DoubleSpan values) {
+  Append(key, key_length);
+  for (size_t i = 0; i < values.size; ++i) {
+    if (i > 0) {
+      buffer_[length_++] = ',';
+    }
+    AppendDouble(values[i]);
+  }
+}
+
+void SteerWriter::AppendDouble(double x) {
+  char* out = &buffer_[length_];
+
+  // json.hpp serializes NaN and infinity as null
+  if (!std::isfinite(x)) {
+    Append("null", 4);
+    return;
+  }
+
+  // Keep the sign of -0.0 the way json.hpp does
+  if (x == 0) {
+    if (std::signbit(x)) {
+      Append("-0.0", 4);
+    } else {
+      Append("0.0", 3);
+    }
+    return;
+  }
+
+  char* p = out;
+  if (x < 0) {
+    *p++ = '-';
+    x = -x;
+  }
+  char digits[kMaxDigits];
+  int length = 0;
+  int exponent = 0;
+  Grisu2(x, digits, &length, &exponent);
+
+  // Lay the digits out the way %.<P>g does, where P is the 15 digits
+  // json.hpp printed or more if the value needs them: plain notation for
+  // decimal exponents in [-4, P), exponent notation otherwise.
+  const int point = length + exponent;
+  const int precision = length > 15 ? length : 15;
+  if (point - 1 < -4 || point - 1 >= precision) {
+    *p++ = digits[0];
+    if (length > 1) {
+      *p++ = '.';
+      memcpy(p, digits + 1, length - 1);
+      p += length - 1;
+    }
+    p = AppendExponent(p, point - 1);
+  } else if (point <= 0) {
+    *p++ = '0';
+    *p++ = '.';
+    memset(p, '0', -point);
+    p += -point;
+    memcpy(p, digits, length);
+    p += length;
+  } else if (point >= length) {
+    memcpy(p, digits, length);
+    p += length;
+    memset(p, '0', point - length);
+    p += point - length;
+  } else {
+    memcpy(p, digits, point);
+    p += point;
+    *p++ = '.';
+    memcpy(p, digits + point, length - point);
+    p += length - point;
+  }
+  const int written = static_cast<int>(p - out);
+
+  // Integral values keep a ".0" so the simulator still reads a float
+  bool int_like = true;
+  for (int i = 0; i < written; ++i) {
+    if (out[i] == '.' || out[i] == 'e') {
+      int_like = false;
+      break;
+    }
+  }
+  length_ += written;
+  if (int_like) {
+    Append(".0", 2);
+  }
+}
@@ -0,0 +1,60 @@
+#ifndef STEER_WRITER_H
+#define STEER_WRITER_H
+
+#include <cstddef>
+#include <vector>
+
+// A read-only view over `size` doubles spaced `stride` elements apart.
+// Lets the writer consume interleaved solver output without copying it.
+struct DoubleSpan {
+  const double* data;
+  size_t size;
+  size_t stride;
+
+  DoubleSpan() : data(nullptr), size(0), stride(1) {}
+  DoubleSpan(const double* data, size_t size, size_t stride = 1)
+      : data(data), size(size), stride(stride) {}
+
+  double operator[](size_t i) const { return data[i * stride]; }
+};
+
+// Encodes the "steer" Socket.IO event straight into a reusable byte buffer.
+//
+// The output has the layout `"42[\"steer\"," + msgJson.dump() + "]"` had
+// with json.hpp: keys in sorted order, no whitespace, integral doubles
+// written as "1.0" and non-finite values as null. Doubles are written with
+// the shortest digits that read back to the same value, laid out like %g,
+// so every value round-trips where json.hpp's %.15g could round the last
+// digits away.
+//
+// One writer is kept per connection. The buffer only grows when a message
+// is larger than anything written before, so steady-state writes do not
+// allocate.
+class SteerWriter {
+ public:
+  explicit SteerWriter(size_t capacity = 4096);
+
+  // Serialize a reply into the buffer, replacing the previous one.
+  void Write(double steering_angle, double throttle, DoubleSpan next_x,
+             DoubleSpan next_y, DoubleSpan mpc_x, DoubleSpan mpc_y);
+
+  // Serialize the empty "manual" event sent while no telemetry is available.
+  void WriteManual();
+
+  const char* data() const { return buffer_.data(); }
+  size_t length() const { return length_; }
+
+ private:
+  // Upper bound for one formatted double plus its separator.
+  static const size_t kMaxNumberLength = 32;
+
+  void Reserve(size_t bytes);
+  void Append(const char* s, size_t n);
+  void AppendDouble(double x);
+  void AppendArray(const char* key, size_t key_length, DoubleSpan values);
+
+  std::vector<char> buffer_;
+  size_t length_;
+};
+
+#endif /* STEER_WRITER_H */
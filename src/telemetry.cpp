@@ -0,0 +1,44 @@
+#include "telemetry.h"
+#include <math.h>
+#include <algorithm>
+#include "Eigen-3.3/Eigen/Core"
+
+using std::string;
+
+string hasData(string s) {
+  auto found_null = s.find("null");
+  auto b1 = s.find_first_of("[");
+  auto b2 = s.rfind("}]");
+  if (found_null != string::npos) {
+    return "";
+  } else if (b1 != string::npos && b2 != string::npos) {
+    return s.substr(b1, b2 - b1 + 2);
+  }
+  return "";
+}
+
+void GlobalToVehicle(double px, double py, double psi,
+                     std::vector<double>* ptsx, std::vector<double>* ptsy) {
+  const size_t n = std::min(ptsx->size(), ptsy->size());
+  GlobalToVehicle(px, py, psi, ptsx->data(), ptsy->data(), n, ptsx->data(),
+                  ptsy->data());
+}
+
+void GlobalToVehicle(double px, double py, double psi, const double* x,
+                     const double* y, size_t n, double* out_x, double* out_y) {
+  // Points per block; the offsets of a block live on the stack so the
+  // outputs can overwrite the inputs
+  const int kBlock = 64;
+  typedef Eigen::Array<double, Eigen::Dynamic, 1, 0, kBlock, 1> Block;
+
+  // Rotate by -psi
+  const double c = cos(psi);
+  const double s = sin(psi);
+  for (size_t start = 0; start < n; start += kBlock) {
+    const int m = static_cast<int>(std::min<size_t>(kBlock, n - start));
+    const Block dx = Eigen::Map<const Eigen::ArrayXd>(x + start, m) - px;
+    const Block dy = Eigen::Map<const Eigen::ArrayXd>(y + start, m) - py;
+    Eigen::Map<Eigen::ArrayXd>(out_x + start, m) = dx * c + dy * s;
+    Eigen::Map<Eigen::ArrayXd>(out_y + start, m) = dy * c - dx * s;
+  }
+}
@@ -0,0 +1,26 @@
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// Checks if the SocketIO event has JSON data.
+// If there is data the JSON object in string format will be returned,
+// else the empty string "" will be returned.
+std::string hasData(std::string s);
+
+// Transform waypoints from global coordinates to the car's coordinate
+// system: the car at (px, py) sits at the origin, heading along +x.
+void GlobalToVehicle(double px, double py, double psi,
+                     std::vector<double>* ptsx, std::vector<double>* ptsy);
+
+// GlobalToVehicle for `n` points read from (x, y) and written to
+// (out_x, out_y), which may be the same arrays. The rotation is computed
+// once and the points go through Eigen packet (SIMD) math in blocks held on
+// the stack, so any number of points, up to a whole track, transforms
+// without touching the heap.
+void GlobalToVehicle(double px, double py, double psi, const double* x,
+                     const double* y, size_t n, double* out_x, double* out_y);
+
+#endif /* TELEMETRY_H */
@@ -0,0 +1,235 @@
+#include "trace.h"
+#include <unistd.h>
+#include <condition_variable>
+#include <cstdio>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace trace_internal {
+std::atomic<bool> enabled(false);
+}  // namespace trace_internal
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+struct Span {
+  const char* name;
+  int64_t start_ns;
+  int64_t end_ns;
+  uint64_t message;
+  uint32_t connection;
+  int32_t iteration;
+};
+
+// Single producer (the owning thread), single consumer (the writer thread).
+class SpanRing {
+ public:
+  // Spans buffered per thread; 2.5 MB
+  static const size_t kCapacity = 1 << 16;
+
+  SpanRing(uint32_t tid, const std::string& name)
+      : tid(tid), name(name), spans_(kCapacity), head_(0), tail_(0),
+        dropped_(0) {}
+
+  void Push(const Span& span) {
+    const size_t head = head_.load(std::memory_order_relaxed);
+    if (head - tail_.load(std::memory_order_acquire) == kCapacity) {
+      dropped_.store(dropped_.load(std::memory_order_relaxed) + 1,
+                     std::memory_order_relaxed);
+      return;
+    }
+    spans_[head & (kCapacity - 1)] = span;
+    head_.store(head + 1, std::memory_order_release);
+  }
+
+  // Hand every buffered span to `write` and free their slots.
+  template <typename Write>
+  void Drain(Write write) {
+    const size_t tail = tail_.load(std::memory_order_relaxed);
+    const size_t head = head_.load(std::memory_order_acquire);
+    for (size_t i = tail; i != head; ++i) {
+      write(spans_[i & (kCapacity - 1)]);
+    }
+    tail_.store(head, std::memory_order_release);
+  }
+
+  uint64_t dropped() const { return dropped_.load(std::memory_order_relaxed); }
+
+  const uint32_t tid;
+  const std::string name;
+
+ private:
+  std::vector<Span> spans_;
+  std::atomic<size_t> head_;
+  std::atomic<size_t> tail_;
+  std::atomic<uint64_t> dropped_;
+};
+
+// Writer state, guarded by `mutex`. Rings are never freed: their threads
+// may record until the process exits.
+struct Tracer {
+  std::mutex mutex;
+  std::condition_variable wake;
+  std::vector<SpanRing*> rings;
+  // Rings whose thread_name metadata is already in the file
+  size_t named_rings = 0;
+  FILE* file = nullptr;
+  bool first_event = true;
+  bool stopping = false;
+  int64_t start_ns = 0;
+  std::thread writer;
+};
+
+Tracer& GetTracer() {
+  static Tracer* tracer = new Tracer;
+  return *tracer;
+}
+
+thread_local SpanRing* local_ring = nullptr;
+thread_local std::string* local_name = nullptr;
+thread_local uint32_t current_connection = 0;
+thread_local uint64_t current_message = 0;
+
+int64_t Nanoseconds(Clock::time_point t) {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             t.time_since_epoch())
+      .count();
+}
+
+SpanRing* LocalRing() {
+  if (local_ring == nullptr) {
+    Tracer& tracer = GetTracer();
+    std::lock_guard<std::mutex> lock(tracer.mutex);
+    const uint32_t tid = static_cast<uint32_t>(tracer.rings.size() + 1);
+    local_ring = new SpanRing(
+        tid, local_name ? *local_name : "thread " + std::to_string(tid));
+    tracer.rings.push_back(local_ring);
+  }
+  return local_ring;
+}
+
+void BeginEvent(Tracer* tracer) {
+  fputs(tracer->first_event ? "\n" : ",\n", tracer->file);
+  tracer->first_event = false;
+}
+
+// Write new thread names and every buffered span. Called with the mutex
+// held.
+void WriteBuffered(Tracer* tracer) {
+  const int pid = getpid();
+  for (; tracer->named_rings < tracer->rings.size(); ++tracer->named_rings) {
+    const SpanRing* ring = tracer->rings[tracer->named_rings];
+    BeginEvent(tracer);
+    fprintf(tracer->file,
+            "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%u,"
+            "\"args\":{\"name\":\"%s\"}}",
+            pid, ring->tid, ring->name.c_str());
+  }
+  for (SpanRing* ring : tracer->rings) {
+    ring->Drain([tracer, ring, pid](const Span& span) {
+      BeginEvent(tracer);
+      fprintf(tracer->file,
+              "{\"name\":\"%s\",\"ph\":\"X\",\"pid\":%d,\"tid\":%u,"
+              "\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"connection\":%u,"
+              "\"message\":%llu",
+              span.name, pid, ring->tid,
+              (span.start_ns - tracer->start_ns) / 1e3,
+              (span.end_ns - span.start_ns) / 1e3, span.connection,
+              static_cast<unsigned long long>(span.message));
+      if (span.iteration >= 0) {
+        fprintf(tracer->file, ",\"iteration\":%d", span.iteration);
+      }
+      fputs("}}", tracer->file);
+    });
+  }
+}
+
+void WriterLoop() {
+  Tracer& tracer = GetTracer();
+  std::unique_lock<std::mutex> lock(tracer.mutex);
+  while (!tracer.stopping) {
+    tracer.wake.wait_for(lock, std::chrono::milliseconds(100));
+    WriteBuffered(&tracer);
+  }
+}
+
+}  // namespace
+
+namespace trace_internal {
+
+void Record(const char* name, Clock::time_point start, Clock::time_point end,
+            int iteration) {
+  Span span;
+  span.name = name;
+  span.start_ns = Nanoseconds(start);
+  span.end_ns = Nanoseconds(end);
+  span.message = current_message;
+  span.connection = current_connection;
+  span.iteration = iteration;
+  LocalRing()->Push(span);
+}
+
+}  // namespace trace_internal
+
+bool StartTracing(const std::string& path) {
+  Tracer& tracer = GetTracer();
+  std::lock_guard<std::mutex> lock(tracer.mutex);
+  tracer.file = fopen(path.c_str(), "w");
+  if (tracer.file == nullptr) {
+    return false;
+  }
+  // JSON array format: viewers accept a file cut off before the closing
+  // bracket, so a trace of a crashed run still loads
+  fputs("[", tracer.file);
+  tracer.start_ns = Nanoseconds(Clock::now());
+  tracer.writer = std::thread(WriterLoop);
+  trace_internal::enabled.store(true, std::memory_order_relaxed);
+  return true;
+}
+
+void StopTracing() {
+  Tracer& tracer = GetTracer();
+  if (!TracingEnabled()) {
+    return;
+  }
+  trace_internal::enabled.store(false, std::memory_order_relaxed);
+  {
+    std::lock_guard<std::mutex> lock(tracer.mutex);
+    tracer.stopping = true;
+  }
+  tracer.wake.notify_one();
+  tracer.writer.join();
+
+  std::lock_guard<std::mutex> lock(tracer.mutex);
+  WriteBuffered(&tracer);
+  fputs("\n]\n", tracer.file);
+  fclose(tracer.file);
+  tracer.file = nullptr;
+  uint64_t dropped = 0;
+  for (const SpanRing* ring : tracer.rings) {
+    dropped += ring->dropped();
+  }
+  if (dropped > 0) {
+    std::cerr << "Trace dropped " << dropped << " spans" << std::endl;
+  }
+}
+
+void SetTraceThreadName(const std::string& name) {
+  delete local_name;
+  local_name = new std::string(name);
+}
+
+TraceScope::TraceScope(uint32_t connection, uint64_t message)
+    : saved_connection_(current_connection),
+      saved_message_(current_message) {
+  current_connection = connection;
+  current_message = message;
+}
+
+TraceScope::~TraceScope() {
+  current_connection = saved_connection_;
+  current_message = saved_message_;
+}
@@ -0,0 +1,66 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+// Opt-in span tracer writing Chrome trace-event JSON (chrome://tracing,
+// ui.perfetto.dev).
+//
+// Every thread that records gets a preallocated ring of spans the first time
+// it records; a writer thread drains the rings into the trace file while
+// tracing runs. Recording is a handful of stores into the calling thread's
+// ring, with no locks. When tracing is off every entry point returns after
+// one relaxed atomic load. If a ring fills up faster than the writer drains
+// it, new spans are dropped and counted.
+//
+// Spans are tagged with the recording thread and with the connection and
+// message set by TraceScope on that thread.
+
+namespace trace_internal {
+extern std::atomic<bool> enabled;
+void Record(const char* name, std::chrono::steady_clock::time_point start,
+            std::chrono::steady_clock::time_point end, int iteration);
+}  // namespace trace_internal
+
+inline bool TracingEnabled() {
+  return trace_internal::enabled.load(std::memory_order_relaxed);
+}
+
+// Start writing spans to `path`. Returns false if it cannot be opened.
+bool StartTracing(const std::string& path);
+
+// Write out what is buffered and close the trace file.
+void StopTracing();
+
+// Name the calling thread in the trace ("shard 0 solver", ...). Takes
+// effect for threads that have not recorded yet.
+void SetTraceThreadName(const std::string& name);
+
+// Record a span that ran from `start` to `end` on the calling thread.
+// `name` must outlive the tracer (a string literal). `iteration` is added to
+// the span's arguments unless negative.
+inline void TraceSpan(const char* name,
+                      std::chrono::steady_clock::time_point start,
+                      std::chrono::steady_clock::time_point end,
+                      int iteration = -1) {
+  if (TracingEnabled()) {
+    trace_internal::Record(name, start, end, iteration);
+  }
+}
+
+// Tags spans recorded on this thread with a connection and message id until
+// destroyed.
+class TraceScope {
+ public:
+  TraceScope(uint32_t connection, uint64_t message);
+  ~TraceScope();
+
+ private:
+  const uint32_t saved_connection_;
+  const uint64_t saved_message_;
+};
+
+#endif /* TRACE_H */
@@ -0,0 +1,248 @@
+#include "track.h"
+#include <math.h>
+#include <algorithm>
+#include <fstream>
+#include <limits>
+#include <sstream>
+
+constexpr double Track::kCellSize;
+
+Track::Track() : arrays_() { ViewOwned(); }
+
+Track::Track(const Arrays& arrays) : arrays_(arrays) {}
+
+Track::Track(const Track& other) : arrays_() { CopyFrom(other.arrays_); }
+
+Track& Track::operator=(const Track& other) {
+  if (this != &other) {
+    CopyFrom(other.arrays_);
+  }
+  return *this;
+}
+
+void Track::CopyFrom(const Arrays& arrays) {
+  const size_t cells = static_cast<size_t>(arrays.grid_cols) *
+                       arrays.grid_rows;
+  x_.assign(arrays.x, arrays.x + arrays.size);
+  y_.assign(arrays.y, arrays.y + arrays.size);
+  s_.assign(arrays.s, arrays.s + (arrays.size > 0 ? arrays.size + 1 : 0));
+  cell_start_.assign(arrays.cell_start,
+                     arrays.cell_start + (cells > 0 ? cells + 1 : 0));
+  cell_segments_.assign(
+      arrays.cell_segments,
+      arrays.cell_segments + (cells > 0 ? arrays.cell_start[cells] : 0));
+  arrays_.grid_x0 = arrays.grid_x0;
+  arrays_.grid_y0 = arrays.grid_y0;
+  arrays_.grid_cols = arrays.grid_cols;
+  arrays_.grid_rows = arrays.grid_rows;
+  ViewOwned();
+}
+
+void Track::ViewOwned() {
+  arrays_.size = x_.size();
+  arrays_.x = x_.data();
+  arrays_.y = y_.data();
+  arrays_.s = s_.data();
+  arrays_.cell_start = cell_start_.data();
+  arrays_.cell_segments = cell_segments_.data();
+}
+
+bool Track::LoadCsv(const std::string& path) {
+  std::ifstream in(path.c_str());
+  if (!in) {
+    return false;
+  }
+  x_.clear();
+  y_.clear();
+  s_.clear();
+  cell_start_.clear();
+  cell_segments_.clear();
+  arrays_ = Arrays();
+  ViewOwned();
+  std::string line;
+  // Header
+  std::getline(in, line);
+  while (std::getline(in, line)) {
+    std::istringstream fields(line);
+    double x, y;
+    char comma;
+    if (fields >> x >> comma >> y && comma == ',') {
+      x_.push_back(x);
+      y_.push_back(y);
+    }
+  }
+  if (x_.size() < 3) {
+    return false;
+  }
+
+  s_.assign(x_.size() + 1, 0.0);
+  for (size_t i = 0; i < x_.size(); ++i) {
+    size_t j = (i + 1) % x_.size();
+    s_[i + 1] = s_[i] + hypot(x_[j] - x_[i], y_[j] - y_[i]);
+  }
+  BuildGrid();
+  ViewOwned();
+  return true;
+}
+
+void Track::BuildGrid() {
+  const double pad = kCellSize;
+  const auto x_range = std::minmax_element(x_.begin(), x_.end());
+  const auto y_range = std::minmax_element(y_.begin(), y_.end());
+  const double x0 = *x_range.first - pad;
+  const double y0 = *y_range.first - pad;
+  // Index of the cell holding `v` along an axis starting at `origin`
+  auto cell_of = [](double v, double origin) {
+    return static_cast<int>((v - origin) / kCellSize);
+  };
+  const int cols = cell_of(*x_range.second + pad, x0) + 1;
+  const int rows = cell_of(*y_range.second + pad, y0) + 1;
+  arrays_.grid_x0 = x0;
+  arrays_.grid_y0 = y0;
+  arrays_.grid_cols = cols;
+  arrays_.grid_rows = rows;
+
+  // Cells of each segment's grown bounding box; counted first, then filled
+  auto for_each_cell = [&](size_t i, std::vector<uint32_t>* counts,
+                           std::vector<uint32_t>* fill) {
+    size_t j = (i + 1) % x_.size();
+    int col0 = cell_of(std::min(x_[i], x_[j]) - pad, x0);
+    int col1 = cell_of(std::max(x_[i], x_[j]) + pad, x0);
+    int row0 = cell_of(std::min(y_[i], y_[j]) - pad, y0);
+    int row1 = cell_of(std::max(y_[i], y_[j]) + pad, y0);
+    for (int row = std::max(row0, 0); row <= std::min(row1, rows - 1); ++row) {
+      for (int col = std::max(col0, 0); col <= std::min(col1, cols - 1);
+           ++col) {
+        const size_t cell = static_cast<size_t>(row) * cols + col;
+        if (counts != nullptr) {
+          ++(*counts)[cell + 1];
+        } else {
+          cell_segments_[(*fill)[cell]++] = static_cast<uint32_t>(i);
+        }
+      }
+    }
+  };
+
+  const size_t cells = static_cast<size_t>(cols) * rows;
+  cell_start_.assign(cells + 1, 0);
+  for (size_t i = 0; i < x_.size(); ++i) {
+    for_each_cell(i, &cell_start_, nullptr);
+  }
+  for (size_t c = 0; c < cells; ++c) {
+    cell_start_[c + 1] += cell_start_[c];
+  }
+  cell_segments_.resize(cell_start_[cells]);
+  std::vector<uint32_t> next(cell_start_.begin(), cell_start_.end() - 1);
+  for (size_t i = 0; i < x_.size(); ++i) {
+    for_each_cell(i, nullptr, &next);
+  }
+}
+
+double Track::SegmentDistance2(size_t i, double px, double py,
+                               TrackProjection* projection) const {
+  const double* x = arrays_.x;
+  const double* y = arrays_.y;
+  const double* s = arrays_.s;
+  size_t j = (i + 1) % arrays_.size;
+  double sx = x[j] - x[i];
+  double sy = y[j] - y[i];
+  double dx = px - x[i];
+  double dy = py - y[i];
+  double len2 = sx * sx + sy * sy;
+  double t = len2 > 0 ? (dx * sx + dy * sy) / len2 : 0.0;
+  t = fmin(fmax(t, 0.0), 1.0);
+  double ex = dx - t * sx;
+  double ey = dy - t * sy;
+
+  projection->segment = i;
+  projection->s = s[i] + t * (s[i + 1] - s[i]);
+  // Left of the direction of travel is positive
+  double d = sqrt(ex * ex + ey * ey);
+  projection->offset = sx * dy - sy * dx >= 0 ? d : -d;
+  return ex * ex + ey * ey;
+}
+
+TrackProjection Track::Project(double px, double py) const {
+  const Arrays& a = arrays_;
+  const int col = static_cast<int>(floor((px - a.grid_x0) / kCellSize));
+  const int row = static_cast<int>(floor((py - a.grid_y0) / kCellSize));
+  if (col >= 0 && col < a.grid_cols && row >= 0 && row < a.grid_rows) {
+    // Every segment within kCellSize of the point is listed in its cell, so
+    // a closest one that near is the closest of all
+    const size_t cell = static_cast<size_t>(row) * a.grid_cols + col;
+    TrackProjection best = TrackProjection();
+    double best_d2 = kCellSize * kCellSize;
+    bool found = false;
+    for (uint32_t k = a.cell_start[cell]; k < a.cell_start[cell + 1]; ++k) {
+      TrackProjection p;
+      double d2 = SegmentDistance2(a.cell_segments[k], px, py, &p);
+      if (d2 <= best_d2) {
+        best_d2 = d2;
+        best = p;
+        found = true;
+      }
+    }
+    if (found) {
+      return best;
+    }
+  }
+  return ProjectAll(px, py);
+}
+
+TrackProjection Track::Project(double px, double py,
+                               const TrackProjection& hint) const {
+  // The hint's segment, the one before and two after it
+  TrackProjection best = TrackProjection();
+  double best_d2 = kCellSize * kCellSize;
+  bool found = false;
+  const size_t n = arrays_.size;
+  for (size_t k = 0; k < 4; ++k) {
+    TrackProjection p;
+    double d2 = SegmentDistance2((hint.segment + n - 1 + k) % n, px, py, &p);
+    if (d2 <= best_d2) {
+      best_d2 = d2;
+      best = p;
+      found = true;
+    }
+  }
+  return found ? best : Project(px, py);
+}
+
+void Track::PointsAlong(double s, double spacing, size_t n, double* x,
+                        double* y) const {
+  const Arrays& a = arrays_;
+  const double length = a.s[a.size];
+  double target = fmod(s, length);
+  if (target < 0) {
+    target += length;
+  }
+  // Segment holding `target`: a.s[i] <= target < a.s[i + 1]
+  size_t i = std::upper_bound(a.s, a.s + a.size + 1, target) - a.s - 1;
+  for (size_t k = 0; k < n; ++k) {
+    while (target >= a.s[i + 1]) {
+      if (++i == a.size) {
+        i = 0;
+        target -= length;
+      }
+    }
+    const size_t j = (i + 1) % a.size;
+    const double t = (target - a.s[i]) / (a.s[i + 1] - a.s[i]);
+    x[k] = a.x[i] + t * (a.x[j] - a.x[i]);
+    y[k] = a.y[i] + t * (a.y[j] - a.y[i]);
+    target += spacing;
+  }
+}
+
+TrackProjection Track::ProjectAll(double px, double py) const {
+  TrackProjection best = TrackProjection();
+  double best_d2 = std::numeric_limits<double>::max();
+  for (size_t i = 0; i < arrays_.size; ++i) {
+    TrackProjection p;
+    double d2 = SegmentDistance2(i, px, py, &p);
+    if (d2 < best_d2) {
+      best_d2 = d2;
+      best = p;
+    }
+  }
+  return best;
+}
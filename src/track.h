@@ -0,0 +1,117 @@
+#ifndef TRACK_H
+#define TRACK_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Where a point projects onto the track's center line.
+struct TrackProjection {
+  // Segment from waypoint `segment` to the next one
+  size_t segment;
+  // Arc length of the projected point, measured from waypoint 0
+  double s;
+  // Signed distance from the center line, positive to the left
+  double offset;
+};
+
+// A closed loop of waypoints in global coordinates, such as
+// lake_track_waypoints.csv.
+//
+// Loading also builds a uniform grid over the segments, so finding the
+// closest segment takes a look at one cell instead of every segment. A
+// loaded track is never modified and can be shared by any number of
+// threads.
+//
+// A track either owns its arrays (loaded or copied) or views arrays it was
+// given, such as those of a mapped track file.
+class Track {
+ public:
+  // Side of a grid cell, in meters; also how far from the track a point can
+  // be and still be projected through the grid
+  static constexpr double kCellSize = 20.0;
+
+  // Everything a track is made of, for writing it to a track file and
+  // viewing it from one.
+  struct Arrays {
+    // Waypoints
+    size_t size;
+    const double* x;
+    const double* y;
+    // size + 1 arc lengths, see s()
+    const double* s;
+    // Cell (col, row) covers [grid_x0 + col * kCellSize, ...) and lists the
+    // segments whose bounding box, grown by kCellSize, overlaps it:
+    // cell_segments[cell_start[cell] .. cell_start[cell + 1])
+    double grid_x0;
+    double grid_y0;
+    int grid_cols;
+    int grid_rows;
+    // grid_cols * grid_rows + 1 entries
+    const uint32_t* cell_start;
+    const uint32_t* cell_segments;
+  };
+
+  Track();
+  // A track viewing `arrays`, which must outlive it.
+  explicit Track(const Arrays& arrays);
+  // Copies own their arrays, whatever `other` does.
+  Track(const Track& other);
+  Track(Track&& other) = default;
+  Track& operator=(const Track& other);
+  Track& operator=(Track&& other) = default;
+
+  // Load an "x,y" CSV with a header line. Returns false if the file cannot
+  // be read or holds fewer than three waypoints.
+  bool LoadCsv(const std::string& path);
+
+  size_t size() const { return arrays_.size; }
+  const double* x() const { return arrays_.x; }
+  const double* y() const { return arrays_.y; }
+  // Arc length from waypoint 0 to waypoint i; s(size()) is the lap length
+  double s(size_t i) const { return arrays_.s[i]; }
+  double length() const { return arrays_.s[arrays_.size]; }
+  const Arrays& arrays() const { return arrays_; }
+
+  // Project (px, py) onto the closest segment.
+  TrackProjection Project(double px, double py) const;
+
+  // Project (px, py) onto the closest of the segments around `hint`, a
+  // projection of the previous position, if one is within kCellSize; else
+  // as Project(px, py). Besides skipping the grid, this keeps following
+  // the same stretch where two pass close to each other.
+  TrackProjection Project(double px, double py,
+                          const TrackProjection& hint) const;
+
+  // `n` points every `spacing` meters along the center line, starting at
+  // arc length `s` and wrapping around the lap.
+  void PointsAlong(double s, double spacing, size_t n, double* x,
+                   double* y) const;
+
+ private:
+  // Projection of (px, py) onto segment i, by squared distance
+  double SegmentDistance2(size_t i, double px, double py,
+                          TrackProjection* projection) const;
+
+  // Closest of every segment
+  TrackProjection ProjectAll(double px, double py) const;
+
+  void BuildGrid();
+
+  // Copy `arrays` into the vectors below and view those.
+  void CopyFrom(const Arrays& arrays);
+  // Point arrays_ at the vectors below.
+  void ViewOwned();
+
+  Arrays arrays_;
+
+  // Storage of a track that owns its arrays
+  std::vector<double> x_;
+  std::vector<double> y_;
+  std::vector<double> s_;
+  std::vector<uint32_t> cell_start_;
+  std::vector<uint32_t> cell_segments_;
+};
+
+#endif /* TRACK_H */
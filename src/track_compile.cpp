@@ -0,0 +1,81 @@
+// Compiles a waypoint CSV into a track file for `mpc --track`: the points,
+// the fitted spline, its arc length, heading and curvature tables and the
+// spatial index, ready to be mapped (see track_file.h).
+//
+// Usage: track_compile waypoints.csv track.bin
+//
+// The output is checked by mapping it back and comparing projections with
+// the freshly fitted track.
+
+#include <math.h>
+#include <iostream>
+#include <string>
+#include "spline_track.h"
+#include "track.h"
+#include "track_file.h"
+
+namespace {
+
+// Largest difference in projected arc length or offset allowed between the
+// fitted and the mapped track
+const double kCheckTolerance = 1e-9;
+
+// Project points around the lap, off to both sides, onto both tracks.
+bool SameProjections(const SplineTrack& fitted, const SplineTrack& mapped) {
+  for (double s = 0; s < fitted.length(); s += 1.0) {
+    const SplinePoint p = fitted.At(s);
+    const double side = 3 * sin(s / 20);
+    const double x = p.x - side * sin(p.heading);
+    const double y = p.y + side * cos(p.heading);
+    const TrackProjection a = fitted.Project(x, y);
+    const TrackProjection b = mapped.Project(x, y);
+    if (fabs(a.s - b.s) > kCheckTolerance ||
+        fabs(a.offset - b.offset) > kCheckTolerance) {
+      return false;
+    }
+  }
+  return true;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  if (argc != 3) {
+    std::cerr << "Usage: " << argv[0] << " waypoints.csv track.bin"
+              << std::endl;
+    return -1;
+  }
+  const std::string csv_path = argv[1];
+  const std::string out_path = argv[2];
+
+  Track waypoints;
+  if (!waypoints.LoadCsv(csv_path)) {
+    std::cerr << "Failed to load track " << csv_path << std::endl;
+    return -1;
+  }
+  SplineTrack fitted;
+  fitted.Build(waypoints);
+
+  std::string error;
+  if (!WriteTrackFile(fitted, out_path, &error)) {
+    std::cerr << error << std::endl;
+    return -1;
+  }
+  TrackFile file;
+  if (!file.Open(out_path) || !file.mapped()) {
+    std::cerr << "Cannot read back " << out_path << ": " << file.error()
+              << std::endl;
+    return -1;
+  }
+  if (!SameProjections(fitted, file.track())) {
+    std::cerr << out_path << " does not match the fitted track" << std::endl;
+    return -1;
+  }
+
+  const SplineTrack::Arrays arrays = fitted.arrays();
+  std::cout << out_path << ": " << waypoints.size() << " waypoints, "
+            << fitted.length() << " m lap, " << arrays.entries
+            << " table entries, " << arrays.waypoints.grid_cols << "x"
+            << arrays.waypoints.grid_rows << " grid" << std::endl;
+  return 0;
+}
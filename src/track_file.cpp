@@ -0,0 +1,251 @@
+#include "track_file.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+const char TrackFileFormat::kMagic[8] = {'M', 'P', 'C', 'T', 'R', 'A', 'C', 'K'};
+const uint32_t TrackFileFormat::kVersion;
+const size_t TrackFileFormat::kAlignment;
+
+namespace {
+
+typedef TrackFileFormat Format;
+
+// Appends arrays to a file image, each aligned.
+class ImageWriter {
+ public:
+  ImageWriter() : image_(sizeof(Format::Header), 0) {}
+
+  template <typename T>
+  Format::Array Append(const T* data, size_t count) {
+    image_.resize((image_.size() + Format::kAlignment - 1) /
+                  Format::kAlignment * Format::kAlignment);
+    Format::Array array;
+    array.offset = image_.size();
+    array.count = count;
+    const char* bytes = reinterpret_cast<const char*>(data);
+    image_.insert(image_.end(), bytes, bytes + count * sizeof(T));
+    return array;
+  }
+
+  std::vector<char>& image() { return image_; }
+
+ private:
+  std::vector<char> image_;
+};
+
+// Whether `array` of `T` lies inside a file of `size` bytes, after the
+// header and aligned for T
+template <typename T>
+bool Inside(const Format::Array& array, size_t size) {
+  return array.offset >= sizeof(Format::Header) &&
+         array.offset % alignof(T) == 0 && array.offset <= size &&
+         array.count <= (size - array.offset) / sizeof(T);
+}
+
+}  // namespace
+
+bool WriteTrackFile(const SplineTrack& track, const std::string& path,
+                    std::string* error) {
+  const SplineTrack::Arrays arrays = track.arrays();
+  const Track::Arrays& waypoints = arrays.waypoints;
+  const size_t n = waypoints.size;
+  const size_t cells =
+      static_cast<size_t>(waypoints.grid_cols) * waypoints.grid_rows;
+
+  ImageWriter writer;
+  Format::Header header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, Format::kMagic, sizeof(header.magic));
+  header.version = Format::kVersion;
+  header.grid_x0 = waypoints.grid_x0;
+  header.grid_y0 = waypoints.grid_y0;
+  header.grid_cols = waypoints.grid_cols;
+  header.grid_rows = waypoints.grid_rows;
+  header.lap_begin = arrays.lap_begin;
+  header.lap_end = arrays.lap_end;
+  header.x = writer.Append(waypoints.x, n);
+  header.y = writer.Append(waypoints.y, n);
+  header.s = writer.Append(waypoints.s, n + 1);
+  header.cell_start = writer.Append(waypoints.cell_start, cells + 1);
+  header.cell_segments =
+      writer.Append(waypoints.cell_segments, waypoints.cell_start[cells]);
+  header.waypoint_s = writer.Append(arrays.waypoint_s, n + 1);
+  header.table = writer.Append(arrays.table, arrays.entries);
+  header.knots = writer.Append(arrays.knots, arrays.knot_count);
+  header.control_points =
+      writer.Append(arrays.control_points, 2 * arrays.control_point_count);
+
+  std::vector<char>& image = writer.image();
+  header.file_size = image.size();
+  header.crc = crc32(
+      0L, reinterpret_cast<const Bytef*>(image.data() + sizeof(header)),
+      image.size() - sizeof(header));
+  memcpy(image.data(), &header, sizeof(header));
+
+  // Written next to `path` and renamed over it, so a server starting
+  // meanwhile maps either the old file or the new one
+  const std::string temp = path + ".tmp";
+  FILE* file = fopen(temp.c_str(), "wb");
+  if (file == nullptr) {
+    *error = "cannot create " + temp;
+    return false;
+  }
+  const bool written = fwrite(image.data(), 1, image.size(), file) ==
+                       image.size();
+  if (fclose(file) != 0 || !written) {
+    *error = "cannot write " + temp;
+    remove(temp.c_str());
+    return false;
+  }
+  if (rename(temp.c_str(), path.c_str()) != 0) {
+    *error = "cannot rename " + temp + " to " + path;
+    remove(temp.c_str());
+    return false;
+  }
+  return true;
+}
+
+TrackFile::TrackFile() : fd_(-1), map_(nullptr), size_(0) {}
+
+TrackFile::~TrackFile() {
+  // The track views the mapping, so goes first
+  track_.reset();
+  if (map_ != nullptr) {
+    munmap(const_cast<char*>(map_), size_);
+  }
+  if (fd_ >= 0) {
+    close(fd_);
+  }
+}
+
+bool TrackFile::Open(const std::string& path) {
+  char magic[sizeof(Format::kMagic)] = {0};
+  FILE* file = fopen(path.c_str(), "rb");
+  if (file == nullptr) {
+    error_ = "cannot open " + path;
+    return false;
+  }
+  const size_t read = fread(magic, 1, sizeof(magic), file);
+  fclose(file);
+  if (read == sizeof(magic) &&
+      memcmp(magic, Format::kMagic, sizeof(magic)) == 0) {
+    return Map(path);
+  }
+
+  Track waypoints;
+  if (!waypoints.LoadCsv(path)) {
+    error_ = path + " is neither a compiled track nor a waypoint CSV";
+    return false;
+  }
+  track_.reset(new SplineTrack());
+  track_->Build(waypoints);
+  return true;
+}
+
+bool TrackFile::Map(const std::string& path) {
+  fd_ = open(path.c_str(), O_RDONLY);
+  if (fd_ < 0) {
+    error_ = "cannot open " + path;
+    return false;
+  }
+  struct stat st;
+  if (fstat(fd_, &st) != 0 ||
+      static_cast<size_t>(st.st_size) < sizeof(Format::Header)) {
+    error_ = path + " is truncated";
+    return false;
+  }
+  size_ = static_cast<size_t>(st.st_size);
+  void* map = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd_, 0);
+  if (map == MAP_FAILED) {
+    error_ = "cannot map " + path;
+    return false;
+  }
+  map_ = static_cast<const char*>(map);
+
+  const Format::Header& header =
+      *reinterpret_cast<const Format::Header*>(map_);
+  if (header.version != Format::kVersion) {
+    error_ = path + " is not a version " + std::to_string(Format::kVersion) +
+             " compiled track";
+    return false;
+  }
+  if (header.file_size != size_ ||
+      crc32(0L, reinterpret_cast<const Bytef*>(map_ + sizeof(header)),
+            size_ - sizeof(header)) != header.crc) {
+    error_ = path + " is truncated or corrupt";
+    return false;
+  }
+
+  // Shapes of the arrays; with the checksum matching these only fail for a
+  // file written by a broken compiler
+  const size_t n = header.x.count;
+  const size_t cells =
+      static_cast<size_t>(header.grid_cols) * header.grid_rows;
+  bool valid =
+      n >= 3 && header.y.count == n && header.s.count == n + 1 &&
+      header.waypoint_s.count == n + 1 && cells > 0 &&
+      header.cell_start.count == cells + 1 && header.table.count >= 2 &&
+      header.control_points.count % 2 == 0 &&
+      Inside<double>(header.x, size_) && Inside<double>(header.y, size_) &&
+      Inside<double>(header.s, size_) &&
+      Inside<uint32_t>(header.cell_start, size_) &&
+      Inside<uint32_t>(header.cell_segments, size_) &&
+      Inside<double>(header.waypoint_s, size_) &&
+      Inside<SplineTrack::Entry>(header.table, size_) &&
+      Inside<double>(header.knots, size_) &&
+      Inside<double>(header.control_points, size_);
+  const uint32_t* cell_start =
+      reinterpret_cast<const uint32_t*>(map_ + header.cell_start.offset);
+  const uint32_t* cell_segments =
+      reinterpret_cast<const uint32_t*>(map_ + header.cell_segments.offset);
+  const double* waypoint_s =
+      reinterpret_cast<const double*>(map_ + header.waypoint_s.offset);
+  if (valid) {
+    // A lap with length; every cell's range inside cell_segments, every
+    // segment a waypoint
+    valid = waypoint_s[n] > 0 && cell_start[0] == 0 &&
+            cell_start[cells] == header.cell_segments.count;
+    for (size_t c = 0; valid && c < cells; ++c) {
+      valid = cell_start[c] <= cell_start[c + 1];
+    }
+    for (size_t k = 0; valid && k < header.cell_segments.count; ++k) {
+      valid = cell_segments[k] < n;
+    }
+  }
+  if (!valid) {
+    error_ = path + " has malformed arrays";
+    return false;
+  }
+
+  SplineTrack::Arrays arrays;
+  Track::Arrays& waypoints = arrays.waypoints;
+  waypoints.size = n;
+  waypoints.x = reinterpret_cast<const double*>(map_ + header.x.offset);
+  waypoints.y = reinterpret_cast<const double*>(map_ + header.y.offset);
+  waypoints.s = reinterpret_cast<const double*>(map_ + header.s.offset);
+  waypoints.grid_x0 = header.grid_x0;
+  waypoints.grid_y0 = header.grid_y0;
+  waypoints.grid_cols = header.grid_cols;
+  waypoints.grid_rows = header.grid_rows;
+  waypoints.cell_start = cell_start;
+  waypoints.cell_segments = cell_segments;
+  arrays.waypoint_s = waypoint_s;
+  arrays.entries = header.table.count;
+  arrays.table = reinterpret_cast<const SplineTrack::Entry*>(
+      map_ + header.table.offset);
+  arrays.knot_count = header.knots.count;
+  arrays.knots = reinterpret_cast<const double*>(map_ + header.knots.offset);
+  arrays.control_point_count = header.control_points.count / 2;
+  arrays.control_points =
+      reinterpret_cast<const double*>(map_ + header.control_points.offset);
+  arrays.lap_begin = header.lap_begin;
+  arrays.lap_end = header.lap_end;
+  track_.reset(new SplineTrack(arrays));
+  return true;
+}
@@ -0,0 +1,93 @@
+#ifndef TRACK_FILE_H
+#define TRACK_FILE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include "spline_track.h"
+
+// Compiled tracks.
+//
+// track_compile turns a waypoint CSV into a file holding everything a
+// SplineTrack is made of, so servers map it instead of parsing, fitting and
+// indexing the CSV at every start:
+//
+//   Header
+//   x, y, s, cell_start, cell_segments, waypoint_s, table, knots,
+//   control_points
+//
+// Each array starts on a 64 byte boundary, so a page-aligned mapping can be
+// used in place. A crc32 of everything after the header catches truncated
+// and corrupted files. All numbers are little endian.
+
+struct TrackFileFormat {
+  static const char kMagic[8];
+  static const uint32_t kVersion = 1;
+  static const size_t kAlignment = 64;
+
+  // Where an array starts, from the start of the file, and its element
+  // count
+  struct Array {
+    uint64_t offset;
+    uint64_t count;
+  };
+
+  struct Header {
+    char magic[8];
+    uint32_t version;
+    // crc32 of bytes [sizeof(Header), file_size)
+    uint32_t crc;
+    uint64_t file_size;
+    double grid_x0;
+    double grid_y0;
+    uint32_t grid_cols;
+    uint32_t grid_rows;
+    double lap_begin;
+    double lap_end;
+    // Track::Arrays
+    Array x;
+    Array y;
+    Array s;
+    Array cell_start;
+    Array cell_segments;
+    // SplineTrack::Arrays; control points are counted in doubles
+    Array waypoint_s;
+    Array table;
+    Array knots;
+    Array control_points;
+  };
+};
+
+// Write `track` to `path` as a compiled track. Returns false with `error`
+// set if the file cannot be written.
+bool WriteTrackFile(const SplineTrack& track, const std::string& path,
+                    std::string* error);
+
+// A track for the server: a compiled track file, mapped read-only and used in
+// place, or a waypoint CSV, loaded and fitted.
+class TrackFile {
+ public:
+  TrackFile();
+  ~TrackFile();
+
+  // Open `path`, a compiled track if it starts with the magic and a CSV
+  // otherwise. On failure returns false and error() says why.
+  bool Open(const std::string& path);
+  const std::string& error() const { return error_; }
+
+  // Whether the track is mapped from a compiled file
+  bool mapped() const { return map_ != nullptr; }
+  const SplineTrack& track() const { return *track_; }
+
+ private:
+  bool Map(const std::string& path);
+
+  int fd_;
+  const char* map_;
+  size_t size_;
+  std::unique_ptr<SplineTrack> track_;
+  std::string error_;
+};
+
+#endif /* TRACK_FILE_H */
@@ -0,0 +1,97 @@
+#include "weights_watcher.h"
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <thread>
+#include "metrics.h"
+
+namespace {
+
+// Seconds since the epoch, to compare with file times
+double RealtimeSeconds(const struct timespec& t) {
+  return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+}  // namespace
+
+WeightsWatcher::WeightsWatcher() : fd_(-1), live_(nullptr) {}
+
+bool WeightsWatcher::Start(const std::string& path, const MPCWeights& base,
+                           LiveWeights* live, std::string* error) {
+  const size_t slash = path.rfind('/');
+  const std::string dir =
+      slash == std::string::npos ? "." : path.substr(0, slash + 1);
+  name_ = slash == std::string::npos ? path : path.substr(slash + 1);
+  path_ = path;
+  base_ = base;
+  live_ = live;
+
+  fd_ = inotify_init1(IN_CLOEXEC);
+  if (fd_ < 0) {
+    *error = std::string("inotify_init1: ") + strerror(errno);
+    return false;
+  }
+  if (inotify_add_watch(fd_, dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+    *error = "cannot watch " + dir + ": " + strerror(errno);
+    close(fd_);
+    fd_ = -1;
+    return false;
+  }
+  // Blocks in read() for the life of the process, like the shards
+  std::thread(&WeightsWatcher::Run, this).detach();
+  return true;
+}
+
+void WeightsWatcher::Run() {
+  alignas(struct inotify_event) char buffer[4096];
+  while (true) {
+    const ssize_t n = read(fd_, buffer, sizeof(buffer));
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      std::cerr << "Stopped watching " << path_ << ": " << strerror(errno)
+                << std::endl;
+      return;
+    }
+    // One reload per batch of events, however many of them name the file
+    bool changed = false;
+    for (ssize_t i = 0; i < n;) {
+      const struct inotify_event* event =
+          reinterpret_cast<const struct inotify_event*>(buffer + i);
+      if (event->len > 0 && name_ == event->name) {
+        changed = true;
+      }
+      i += sizeof(struct inotify_event) + event->len;
+    }
+    if (changed) {
+      Reload();
+    }
+  }
+}
+
+void WeightsWatcher::Reload() {
+  struct stat st;
+  const bool has_mtime = stat(path_.c_str(), &st) == 0;
+
+  MPCWeights weights = base_;
+  std::string error;
+  if (!LoadWeights(path_, &weights, &error)) {
+    std::cerr << "Kept the current weights: " << error << std::endl;
+    RecordWeightsReload(false, 0);
+    return;
+  }
+  live_->Set(weights);
+
+  struct timespec now;
+  clock_gettime(CLOCK_REALTIME, &now);
+  const double seconds =
+      has_mtime ? RealtimeSeconds(now) - RealtimeSeconds(st.st_mtim) : 0;
+  RecordWeightsReload(true, seconds);
+  std::cerr << "Reloaded weights from " << path_ << " in " << seconds * 1000
+            << " ms" << std::endl;
+}
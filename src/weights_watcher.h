@@ -0,0 +1,37 @@
+#ifndef WEIGHTS_WATCHER_H
+#define WEIGHTS_WATCHER_H
+
+#include <string>
+#include "live_weights.h"
+#include "mpc_config.h"
+
+// Watches a weights file with inotify and puts every valid version of it
+// into a LiveWeights. Invalid versions are reported and skipped.
+//
+// The directory is watched rather than the file, so both editors that write
+// in place and those that write a new file and rename it over the old one
+// are seen. Each reload logs the time from the file's modification to the
+// new weights being published, and counts it on /metrics.
+class WeightsWatcher {
+ public:
+  WeightsWatcher();
+
+  // Watch `path`, loading each version over `base`, until the process
+  // exits. Returns false with the reason in `error` if inotify is
+  // unavailable.
+  bool Start(const std::string& path, const MPCWeights& base,
+             LiveWeights* live, std::string* error);
+
+ private:
+  void Run();
+  // Load the file and publish it if valid
+  void Reload();
+
+  int fd_;
+  std::string path_;
+  std::string name_;
+  MPCWeights base_;
+  LiveWeights* live_;
+};
+
+#endif /* WEIGHTS_WATCHER_H */